@@ -0,0 +1,111 @@
+/* Logging and event tracing for prefetchers. */
+/* Include after interface.hh, which provides DPRINTF and the types. */
+
+#ifndef PREFETCHER_LOG_HH
+#define PREFETCHER_LOG_HH
+
+#include <stdio.h>
+
+/*
+ * Leveled logging on top of DPRINTF(HWPrefetch, ...).
+ *
+ * The including file defines LOG_LEVEL (and TRACE_ENABLED) in its magic
+ * numbers. Messages above LOG_LEVEL sit behind a constant false branch and
+ * are compiled out, but are still type checked so they don't rot. Enabled
+ * messages print only when run with --trace-flags=HWPrefetch.
+ *
+ *  1: LOG_INFO  - calibration summaries and setup
+ *  2: LOG_DEBUG - prefetch decisions
+ *  3: LOG_TRACE - every table update
+ */
+#define LOG_ENABLED(level) (LOG_LEVEL >= (level))
+#define LOG(level, ...) do { if (LOG_ENABLED(level)) DPRINTF(HWPrefetch, __VA_ARGS__); } while (0)
+#define LOG_INFO(...) LOG(1, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG(2, __VA_ARGS__)
+#define LOG_TRACE(...) LOG(3, __VA_ARGS__)
+
+/*
+ * Binary event ring for high volume tracing.
+ *
+ * TRACE() appends a fixed size record to a ring buffer, claiming its slot
+ * with an atomic increment and no lock. TRACE_INIT() truncates TRACE_FILE
+ * so each run starts a fresh file. trace_flush() appends what was
+ * recorded since the last flush, and when records were overwritten before
+ * they could be flushed, it writes a TRACE_DROPPED record with their count.
+ */
+#define TRACE_RING_SIZE 4096 /* Must be a power of two */
+#define TRACE_FILE "prefetcher_trace.bin"
+
+#define TRACE_ACCESS 1   /* a = address, b = pc */
+#define TRACE_ISSUE 2    /* a = address */
+#define TRACE_COMPLETE 3 /* a = address */
+#define TRACE_STORE 4    /* a = key, b = value */
+#define TRACE_MATCH 5    /* a = address, b = candidates */
+#define TRACE_DROPPED 6  /* a = records lost since the last flush */
+#define TRACE_SAMPLE 7   /* a = accuracy << 32 | coverage, b = measured */
+#define TRACE_FEEDBACK 8 /* a = lateness << 32 | pollution */
+#define TRACE_DECISION 9 /* a = score, b = packed settings */
+
+typedef struct {
+    uint32_t type;
+    uint32_t b;
+    uint64_t a;
+} TraceEvent;
+
+static TraceEvent trace_ring[TRACE_RING_SIZE];
+static uint32_t trace_ring_head = 0;
+static uint32_t trace_ring_tail = 0;
+static uint32_t trace_ring_dropped = 0;
+
+static inline void trace_event(uint32_t type, uint64_t a, uint32_t b)
+{
+    uint32_t slot = __sync_fetch_and_add(&trace_ring_head, 1) & (TRACE_RING_SIZE - 1);
+    trace_ring[slot].type = type;
+    trace_ring[slot].a = a;
+    trace_ring[slot].b = b;
+}
+
+static inline void trace_init()
+{
+    FILE *file = fopen(TRACE_FILE, "wb");
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+    trace_ring_head = 0;
+    trace_ring_tail = 0;
+    trace_ring_dropped = 0;
+}
+
+static inline void trace_flush()
+{
+    uint32_t head = trace_ring_head;
+    uint32_t tail = trace_ring_tail;
+    if (head - tail > TRACE_RING_SIZE)
+    {
+        trace_ring_dropped += head - tail - TRACE_RING_SIZE;
+        tail = head - TRACE_RING_SIZE;
+    }
+    FILE *file = fopen(TRACE_FILE, "ab");
+    if (file != NULL)
+    {
+        if (trace_ring_dropped > 0)
+        {
+            TraceEvent dropped = { TRACE_DROPPED, 0, trace_ring_dropped };
+            fwrite(&dropped, sizeof(TraceEvent), 1, file);
+            trace_ring_dropped = 0;
+        }
+        for (; tail != head; tail++)
+        {
+            fwrite(&trace_ring[tail & (TRACE_RING_SIZE - 1)], sizeof(TraceEvent), 1, file);
+        }
+        fclose(file);
+    }
+    trace_ring_tail = head;
+}
+
+#define TRACE(type, a, b) do { if (TRACE_ENABLED) trace_event((type), (a), (b)); } while (0)
+#define TRACE_INIT() do { if (TRACE_ENABLED) trace_init(); } while (0)
+#define TRACE_FLUSH() do { if (TRACE_ENABLED) trace_flush(); } while (0)
+
+#endif
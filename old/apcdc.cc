@@ -1,4 +1,5 @@
 #include "interface.hh"
+#include "log.hh"
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -6,7 +7,8 @@
 // For GHB sizes up to 2048, KB_SIZE+GHB_SIZE can be 1680 (8KB) : 28+11 bits per line
 
 // Magic Numbers
-#define VERBOSE 1
+#define LOG_LEVEL 1
+#define TRACE_ENABLED 0
 #define CALIBRATION_INTERVAL (2*1024)
 #define KB_SIZE 512
 #define GHB_SIZE 1024
@@ -23,7 +25,7 @@
 
 // Prototypes
 void prefetcher_init();
-void prefetcher_access(AccessStat stat);
+void prefetcher_access(AccessStat stat, int prefetch_hit);
 void prefetcher_delta_correlate();
 void prefetcher_calibrate();
 
@@ -66,6 +68,7 @@ void issue_if_needed(Addr addr)
     if (!in_cache(addr) && !in_mshr_queue(addr) && 0 <= addr && addr < MAX_PHYS_MEM_ADDR)
     {
         issue_prefetch(addr);
+        TRACE(TRACE_ISSUE, addr, 0);
     }
 }
 
@@ -77,6 +80,7 @@ int counter = 0;
 
 void prefetch_init()
 {
+    TRACE_INIT();
     stats_reset();
     prefetcher_init();
 }
@@ -92,14 +96,15 @@ void prefetch_access(AccessStat stat)
         stat_read_hits++;
     }
     
-    // Count hits on prefetched blocks
-    if (!stat.miss && get_prefetch_bit(stat.mem_addr))
+    // Count hits on prefetched blocks (first touch only, the tag is cleared below)
+    int prefetch_hit = !stat.miss && get_prefetch_bit(stat.mem_addr);
+    if (prefetch_hit)
     {
         stat_issued_hits++;
     }
     
     // Run prefetcher logic
-    prefetcher_access(stat);
+    prefetcher_access(stat, prefetch_hit);
     
     // Clear prefetch tag
     clear_prefetch_bit(stat.mem_addr);
@@ -140,7 +145,7 @@ void kb_init(int size)
     kb_size = size;
     kb = (KB_Entry*) calloc(sizeof(KB_Entry), size);
     int bytes = sizeof(KB_Entry)*size;
-    if (VERBOSE >= 1) printf("KB initialized to %d rows (%d bytes)\n", size, bytes);
+    LOG_INFO("KB initialized to %d rows (%d bytes)\n", size, bytes);
 }
 
 void kb_store(KB_Key key, KB_Index index)
@@ -148,7 +153,7 @@ void kb_store(KB_Key key, KB_Index index)
     kb_head = (kb_head + 1) % kb_size;
     kb[kb_head].key = key;
     kb[kb_head].index = index;
-    if (VERBOSE >= 3) printf("KB[%d] now stores [%d,%d]\n", kb_head, key, index);
+    LOG_TRACE("KB[%d] now stores [%d,%d]\n", kb_head, key, index);
 }
 
 //=======================
@@ -172,7 +177,7 @@ void ghb_init(int size)
     ghb_size = size;
     ghb = (GHB_Entry*) calloc(sizeof(GHB_Entry), size);
     int bytes = sizeof(GHB_Entry)*size;
-    if (VERBOSE >= 1) printf("GHB initialized to %d rows (%d bytes)\n", size, bytes);
+    LOG_INFO("GHB initialized to %d rows (%d bytes)\n", size, bytes);
 }
 
 void ghb_store(GHB_Address address, GHB_Index previous)
@@ -180,7 +185,8 @@ void ghb_store(GHB_Address address, GHB_Index previous)
     ghb_head = (ghb_head + 1) % ghb_size;
     ghb[ghb_head].address = address;
     ghb[ghb_head].previous = previous;
-    if (VERBOSE >= 3) printf("GHB[%d] now stores [%d,%d]\n", ghb_head, address, previous);
+    TRACE(TRACE_STORE, address, ghb_head);
+    LOG_TRACE("GHB[%d] now stores [%d,%d]\n", ghb_head, address, previous);
 }
 
 //============
@@ -196,10 +202,10 @@ void prefetcher_init(void)
     ghb_init(GHB_SIZE);
 }
 
-void prefetcher_access(AccessStat stat)
+void prefetcher_access(AccessStat stat, int prefetch_hit)
 {
-    // Exit if not miss
-    if (!stat.miss && STORE_MISSES_ONLY)
+    // Exit if not miss, but keep training on prefetched streams
+    if (!stat.miss && !prefetch_hit && STORE_MISSES_ONLY)
     {
         return;
     }
@@ -307,6 +313,8 @@ void prefetcher_delta_correlate()
             }
             if (match)
             {
+                TRACE(TRACE_MATCH, address, prefetch_degree);
+                
                 // Prefetch
                 for (int k = 0; k < prefetch_degree; k++)
                 {
@@ -314,7 +322,7 @@ void prefetcher_delta_correlate()
                     issue_if_needed(address);
                     buffer_i = (buffer_i - 1 + buffer_size) % buffer_size;
                 }
-                if (VERBOSE >= 2) printf("Prefetching blocks! (degree %d)\n", prefetch_degree);
+                LOG_DEBUG("Prefetching blocks! (degree %d)\n", prefetch_degree);
                 break;
             }
         }
@@ -419,23 +427,24 @@ void prefetcher_calibrate()
     }
     */
     
-    if (VERBOSE >= 1)
-    {
-        printf("[] Calibrating...\n");
-        printf(" - Old PFD: %d\n", prefetch_degree);
-        printf(" - New PFD: %d\n", prefetch_degree + action);
-        printf(" - Old hit rate: %d\n", last_hit_rate);
-        printf(" - New hit rate: %d\n", hit_rate);
-        printf(" - Better: %d\n", better);
-        printf(" - Worse: %d\n", worse);
-        printf(" - Issued hit rate: %d\n", issued_hit_rate);
-        printf(" - Issued Override: %d\n", issued_override);
-        printf(" - Blocked:");
+    if (LOG_ENABLED(1))
+    {
+        LOG_INFO("[] Calibrating...\n");
+        LOG_INFO(" - Old PFD: %d\n", prefetch_degree);
+        LOG_INFO(" - New PFD: %d\n", prefetch_degree + action);
+        LOG_INFO(" - Old hit rate: %d\n", last_hit_rate);
+        LOG_INFO(" - New hit rate: %d\n", hit_rate);
+        LOG_INFO(" - Better: %d\n", better);
+        LOG_INFO(" - Worse: %d\n", worse);
+        LOG_INFO(" - Issued hit rate: %d\n", issued_hit_rate);
+        LOG_INFO(" - Issued Override: %d\n", issued_override);
+        char blocked_list[16 * (PREFETCH_DEGREE_MAX + 1)] = "";
+        int blocked_list_length = 0;
         for (int i = 0; i <= PREFETCH_DEGREE_MAX; i++)
         {
-            printf(" %d,", blocked[i]);
+            blocked_list_length += snprintf(blocked_list + blocked_list_length, sizeof(blocked_list) - blocked_list_length, " %d,", blocked[i]);
         }
-        printf("\n");
+        LOG_INFO(" - Blocked:%s\n", blocked_list);
     }
     
     // Countdown blocks
@@ -450,6 +459,7 @@ void prefetcher_calibrate()
     
     // Reset stats
     stats_reset();
+    TRACE_FLUSH();
 }
 
 
@@ -548,23 +558,25 @@ void prefetcher_calibrate()
         }
     }
     
-    if (VERBOSE >= 1)
+    if (LOG_ENABLED(1))
     {
-        printf("[] Calibrating...\n");
-        printf(" - Old PFD: %d\n", prefetch_degree);
-        printf(" - New PFD: %d\n", next_prefetch_degree);
-        printf(" - Hit rates:");
+        LOG_INFO("[] Calibrating...\n");
+        LOG_INFO(" - Old PFD: %d\n", prefetch_degree);
+        LOG_INFO(" - New PFD: %d\n", next_prefetch_degree);
+        char hit_rates_list[16 * (PREFETCH_DEGREE_MAX + 1)] = "";
+        int hit_rates_list_length = 0;
         for (int i = 0; i <= PREFETCH_DEGREE_MAX; i++)
         {
-            printf(" %d,", hit_rates[i]);
+            hit_rates_list_length += snprintf(hit_rates_list + hit_rates_list_length, sizeof(hit_rates_list) - hit_rates_list_length, " %d,", hit_rates[i]);
         }
-        printf("\n");
-        printf(" - Hit times:");
+        LOG_INFO(" - Hit rates:%s\n", hit_rates_list);
+        char hit_times_list[16 * (PREFETCH_DEGREE_MAX + 1)] = "";
+        int hit_times_list_length = 0;
         for (int i = 0; i <= PREFETCH_DEGREE_MAX; i++)
         {
-            printf(" %d,", hit_times[i]);
+            hit_times_list_length += snprintf(hit_times_list + hit_times_list_length, sizeof(hit_times_list) - hit_times_list_length, " %d,", hit_times[i]);
         }
-        printf("\n");
+        LOG_INFO(" - Hit times:%s\n", hit_times_list);
     }
     
     // Update degree
@@ -623,16 +635,16 @@ void prefetcher_calibrate()
         countdown = COUNTDOWN_SHORT;
     }
     
-    if (VERBOSE >= 1)
+    if (LOG_ENABLED(1))
     {
-        printf("[] Calibrating...\n");
-        printf(" - Hit rate: %d\n", hit_rate);
-        printf(" - Issued hit rate: %d\n", issued_hit_rate);
-        printf(" - Above threshold: %d\n", above_threshold);
-        printf(" - Below threshold: %d\n", below_threshold);
-        printf(" - Old PFD: %d\n", prefetch_degree);
-        printf(" - New PFD: %d\n", next_prefetch_degree);
-        printf(" - Countdown: %d\n", countdown);
+        LOG_INFO("[] Calibrating...\n");
+        LOG_INFO(" - Hit rate: %d\n", hit_rate);
+        LOG_INFO(" - Issued hit rate: %d\n", issued_hit_rate);
+        LOG_INFO(" - Above threshold: %d\n", above_threshold);
+        LOG_INFO(" - Below threshold: %d\n", below_threshold);
+        LOG_INFO(" - Old PFD: %d\n", prefetch_degree);
+        LOG_INFO(" - New PFD: %d\n", next_prefetch_degree);
+        LOG_INFO(" - Countdown: %d\n", countdown);
     }
     
     // Update degree
@@ -725,9 +737,9 @@ void prefetcher_calibrate()
         
         state_next = COUNTDOWN;
         
-        if (VERBOSE >= 1) printf("# New PFD: %d\n", prefetch_degree);
-        if (VERBOSE >= 1) printf("- Scores: %d, %d, %d\n", score_lower, score_current, score_higher);
-        if (VERBOSE >= 1) printf("- Countdown: %d\n", countdown_left);
+        LOG_INFO("# New PFD: %d\n", prefetch_degree);
+        LOG_INFO("- Scores: %d, %d, %d\n", score_lower, score_current, score_higher);
+        LOG_INFO("- Countdown: %d\n", countdown_left);
         
         // Update choice
         previous_choice = prefetch_degree;
@@ -1,14 +1,19 @@
 #include "interface.hh"
+#include "log.hh"
 #include <stdlib.h>
 #include <stdio.h>
 
 // Settings
-#define VERBOSE 0
+#define LOG_LEVEL 0
+#define TRACE_ENABLED 0
 #define HISTORY_SIZE 8
 #define PATTERNS_STORED_SIZE 256
 #define PATTERNS_MATCH_SIZE 4
 #define PATTERNS_PREDICT_SIZE 2
 #define PATTERNS_AGING_FACTOR 2
+#define PATTERNS_INDEX_SIZE (2 * PATTERNS_STORED_SIZE) // Buckets in the exact match index, chains stay short as the table grows
+#define TRIE_NODES (PATTERNS_STORED_SIZE * PATTERNS_MATCH_SIZE + 1)
+#define TRIE_BUCKETS (PATTERNS_STORED_SIZE * PATTERNS_MATCH_SIZE) // Buckets for trie edges, one per node
 
 //==================
 // Helper Functions
@@ -19,6 +24,7 @@ void prefetch_if_not_cached(Addr addr)
     if (!in_cache(addr) && 0 <= addr && addr < MAX_PHYS_MEM_ADDR)
     {
         issue_prefetch(addr);
+        TRACE(TRACE_ISSUE, addr, 0);
     }
 }
 
@@ -26,22 +32,35 @@ void prefetch_if_not_cached(Addr addr)
 // History 
 //=========
 
-AccessStat *history;
+Addr *history;
 int history_index;
 
+// Jumps between the latest accesses, oldest first, followed by
+// PATTERNS_PREDICT_SIZE zeros. The first PATTERNS_MATCH_SIZE +
+// PATTERNS_PREDICT_SIZE values are the current pattern, and the same
+// length starting at PATTERNS_PREDICT_SIZE is the current pattern padded.
+int32_t history_jumps[PATTERNS_MATCH_SIZE + 2*PATTERNS_PREDICT_SIZE];
+
 void history_init(void)
 {
-    history = (AccessStat*) calloc(sizeof(AccessStat), HISTORY_SIZE);
+    history = (Addr*) calloc(sizeof(Addr), HISTORY_SIZE);
     history_index = HISTORY_SIZE-1;
 }
 
-void history_store(AccessStat stat)
+void history_store(Addr addr)
 {
+    // Roll jumps
+    for (int i = 0; i < PATTERNS_MATCH_SIZE + PATTERNS_PREDICT_SIZE - 1; i++)
+    {
+        history_jumps[i] = history_jumps[i+1];
+    }
+    history_jumps[PATTERNS_MATCH_SIZE + PATTERNS_PREDICT_SIZE - 1] = addr - history[history_index];
+    
     history_index = (history_index + 1) % HISTORY_SIZE;
-    history[history_index] = stat;
+    history[history_index] = addr;
 }
 
-AccessStat history_get(int i) // 0 = current, 1 = previous, etc
+Addr history_get(int i) // 0 = current, 1 = previous, etc
 {
     int index = (history_index - i + HISTORY_SIZE) % HISTORY_SIZE;
     return history[index];
@@ -53,182 +72,474 @@ AccessStat history_get(int i) // 0 = current, 1 = previous, etc
 
 typedef struct {
     int32_t score;
+    int32_t epoch; // When score was last settled
     int32_t jumps[PATTERNS_MATCH_SIZE + PATTERNS_PREDICT_SIZE];
 } Pattern;
 
 Pattern *patterns_stored;
+int32_t patterns_epoch = 0;
 
-void patterns_init(void)
+//=======
+// Index
+//=======
+
+// Hash chains over the full jump vector of every stored pattern
+int32_t *index_heads;
+int32_t *index_next;
+
+uint32_t index_hash(int32_t *jumps)
 {
-    if (VERBOSE) printf("patterns_init()\n");
-    
-    // Allocate memory
-    patterns_stored = (Pattern*) calloc(sizeof(Pattern), PATTERNS_STORED_SIZE);
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < PATTERNS_MATCH_SIZE + PATTERNS_PREDICT_SIZE; i++)
+    {
+        hash = (hash ^ (uint32_t) jumps[i]) * 16777619u;
+    }
+    return hash % PATTERNS_INDEX_SIZE;
 }
 
-void pattern_match(Pattern *pat, int32_t *pat_id, int32_t *pat_score)
+int index_equal(int32_t *a, int32_t *b)
 {
-    if (VERBOSE) printf("pattern_match()\n");
+    for (int i = 0; i < PATTERNS_MATCH_SIZE + PATTERNS_PREDICT_SIZE; i++)
+    {
+        if (a[i] != b[i])
+            return 0;
+    }
+    return 1;
+}
 
-    // Reset
-    *pat_id = -1;
-    *pat_score = 0;
-    
-    // Check for match
-    for (int i = 0; i < PATTERNS_STORED_SIZE; i++)
+void index_insert(int32_t pat_id)
+{
+    uint32_t bucket = index_hash(patterns_stored[pat_id].jumps);
+    index_next[pat_id] = index_heads[bucket];
+    index_heads[bucket] = pat_id;
+}
+
+void index_remove(int32_t pat_id)
+{
+    uint32_t bucket = index_hash(patterns_stored[pat_id].jumps);
+    int32_t *link = &index_heads[bucket];
+    while (*link != -1)
     {
-        int score = 0;
-        for (int j = 0; j < PATTERNS_MATCH_SIZE; j++)
+        if (*link == pat_id)
         {
-            if ((*pat).jumps[j] == patterns_stored[i].jumps[j])
-                score++;
-            else
-                break;
+            *link = index_next[pat_id];
+            return;
         }
-        score *= (*pat).score;
-        if (score > *pat_score)
+        link = &index_next[*link];
+    }
+}
+
+int32_t index_find(int32_t *jumps)
+{
+    for (int32_t i = index_heads[index_hash(jumps)]; i != -1; i = index_next[i])
+    {
+        if (index_equal(jumps, patterns_stored[i].jumps))
+            return i;
+    }
+    return -1;
+}
+
+void index_init(void)
+{
+    index_heads = (int32_t*) malloc(sizeof(int32_t) * PATTERNS_INDEX_SIZE);
+    index_next = (int32_t*) malloc(sizeof(int32_t) * PATTERNS_STORED_SIZE);
+    for (int i = 0; i < PATTERNS_INDEX_SIZE; i++)
+    {
+        index_heads[i] = -1;
+    }
+    for (int i = PATTERNS_STORED_SIZE - 1; i >= 0; i--)
+    {
+        index_insert(i);
+    }
+}
+
+//======
+// Trie
+//======
+
+// Prefix trie over the first PATTERNS_MATCH_SIZE jumps of every stored
+// pattern. Edges live in a hash table keyed by (parent, jump), and every
+// node keeps a list of the patterns below it, so the longest prefix match
+// takes PATTERNS_MATCH_SIZE lookups regardless of PATTERNS_STORED_SIZE.
+// Each node also keeps its best scoring pattern. Scores only rise between
+// replacements, so it is kept up to date on insert and increment, and only
+// recomputed from the list when the best pattern itself is replaced.
+
+typedef struct {
+    int32_t parent;
+    int32_t jump;
+    int32_t count;   // Patterns below this node
+    int32_t members; // First pattern below this node
+    int32_t best;    // Best scoring pattern below this node, -1 when it must be recomputed
+    int32_t next;    // Next node in bucket, or next free node
+} TrieNode;
+
+TrieNode *trie;
+int32_t *trie_buckets;
+int32_t trie_free;
+
+// Per pattern and depth: node on its path and links in that node's list
+int32_t *trie_path;
+int32_t *trie_member_next;
+int32_t *trie_member_prev;
+
+int ranking_less(int32_t a, int32_t b);
+
+uint32_t trie_hash(int32_t parent, int32_t jump)
+{
+    return ((uint32_t) parent * 2654435761u ^ (uint32_t) jump * 16777619u) % TRIE_BUCKETS;
+}
+
+int32_t trie_child(int32_t parent, int32_t jump)
+{
+    for (int32_t n = trie_buckets[trie_hash(parent, jump)]; n != -1; n = trie[n].next)
+    {
+        if (trie[n].parent == parent && trie[n].jump == jump)
+            return n;
+    }
+    return -1;
+}
+
+void trie_insert(int32_t pat_id)
+{
+    int32_t node = 0;
+    for (int d = 0; d < PATTERNS_MATCH_SIZE; d++)
+    {
+        int32_t jump = patterns_stored[pat_id].jumps[d];
+        int32_t child = trie_child(node, jump);
+        
+        // Create edge if missing
+        if (child == -1)
         {
-            *pat_id = i;
-            *pat_score = score;
+            child = trie_free;
+            trie_free = trie[child].next;
+            uint32_t bucket = trie_hash(node, jump);
+            trie[child].parent = node;
+            trie[child].jump = jump;
+            trie[child].count = 0;
+            trie[child].members = -1;
+            trie[child].best = pat_id;
+            trie[child].next = trie_buckets[bucket];
+            trie_buckets[bucket] = child;
         }
+        
+        // Add to member list
+        int m = pat_id * PATTERNS_MATCH_SIZE + d;
+        trie_member_prev[m] = -1;
+        trie_member_next[m] = trie[child].members;
+        if (trie[child].members != -1)
+            trie_member_prev[trie[child].members * PATTERNS_MATCH_SIZE + d] = pat_id;
+        trie[child].members = pat_id;
+        trie[child].count++;
+        if (trie[child].best != -1 && ranking_less(trie[child].best, pat_id))
+            trie[child].best = pat_id;
+        
+        trie_path[m] = child;
+        node = child;
     }
-    
-    if (VERBOSE) printf("best:\n");
-    if (VERBOSE) printf("-id:%d\n", *pat_id);
-    if (VERBOSE) printf("-score:%d\n", *pat_score);
 }
 
-void pattern_match_perfect(Pattern *pat, int32_t *pat_id)
+void trie_remove(int32_t pat_id)
 {
-    if (VERBOSE) printf("pattern_match_perfect()\n");
-    
-    // Reset
-    *pat_id = -1;
-    
-    // Check for match
-    for (int i = 0; i < PATTERNS_STORED_SIZE; i++)
+    for (int d = PATTERNS_MATCH_SIZE - 1; d >= 0; d--)
     {
-        int equal = 1;
-        for (int j = 0; j < PATTERNS_MATCH_SIZE + PATTERNS_PREDICT_SIZE; j++)
+        int m = pat_id * PATTERNS_MATCH_SIZE + d;
+        int32_t node = trie_path[m];
+        
+        // Remove from member list
+        int32_t prev = trie_member_prev[m];
+        int32_t next = trie_member_next[m];
+        if (prev != -1)
+            trie_member_next[prev * PATTERNS_MATCH_SIZE + d] = next;
+        else
+            trie[node].members = next;
+        if (next != -1)
+            trie_member_prev[next * PATTERNS_MATCH_SIZE + d] = prev;
+        if (trie[node].best == pat_id)
+            trie[node].best = -1;
+        
+        // Free edge once unused
+        if (--trie[node].count == 0)
         {
-            if ((*pat).jumps[j] != patterns_stored[i].jumps[j])
-                equal = 0;
+            int32_t *link = &trie_buckets[trie_hash(trie[node].parent, trie[node].jump)];
+            while (*link != node)
+            {
+                link = &trie[*link].next;
+            }
+            *link = trie[node].next;
+            trie[node].next = trie_free;
+            trie_free = node;
         }
-        if (equal == 1)
+    }
+}
+
+// Best scoring pattern below a node at depth d
+int32_t trie_best(int32_t node, int d)
+{
+    if (trie[node].best == -1)
+    {
+        int32_t best = trie[node].members;
+        for (int32_t m = trie_member_next[best * PATTERNS_MATCH_SIZE + d]; m != -1; m = trie_member_next[m * PATTERNS_MATCH_SIZE + d])
         {
-            if (VERBOSE) printf("-found:%d\n", i);
-            *pat_id = i;
-            break;
+            if (ranking_less(best, m))
+                best = m;
         }
+        trie[node].best = best;
     }
+    return trie[node].best;
 }
 
-void pattern_current(Pattern *pat)
+// A pattern's score went up, it may now be the best along its path
+void trie_promote(int32_t pat_id)
 {
-    if (VERBOSE) printf("pattern_current()\n");
+    for (int d = 0; d < PATTERNS_MATCH_SIZE; d++)
+    {
+        int32_t node = trie_path[pat_id * PATTERNS_MATCH_SIZE + d];
+        if (trie[node].best != -1 && ranking_less(trie[node].best, pat_id))
+            trie[node].best = pat_id;
+    }
+}
+
+// Best scoring pattern of the deepest node matching a prefix of the jumps, and how deep it is
+void trie_match(int32_t *jumps, int32_t *pat_id, int32_t *length)
+{
+    int32_t node = 0;
+    *pat_id = -1;
+    *length = 0;
+    for (int d = 0; d < PATTERNS_MATCH_SIZE; d++)
+    {
+        int32_t child = trie_child(node, jumps[d]);
+        if (child == -1)
+            break;
+        node = child;
+        *length = d + 1;
+    }
+    if (*length > 0)
+        *pat_id = trie_best(node, *length - 1);
+}
+
+void trie_init(void)
+{
+    trie = (TrieNode*) calloc(sizeof(TrieNode), TRIE_NODES);
+    trie_buckets = (int32_t*) malloc(sizeof(int32_t) * TRIE_BUCKETS);
+    trie_path = (int32_t*) malloc(sizeof(int32_t) * PATTERNS_STORED_SIZE * PATTERNS_MATCH_SIZE);
+    trie_member_next = (int32_t*) malloc(sizeof(int32_t) * PATTERNS_STORED_SIZE * PATTERNS_MATCH_SIZE);
+    trie_member_prev = (int32_t*) malloc(sizeof(int32_t) * PATTERNS_STORED_SIZE * PATTERNS_MATCH_SIZE);
+    for (int i = 0; i < TRIE_BUCKETS; i++)
+    {
+        trie_buckets[i] = -1;
+    }
     
-    (*pat).score = 1;
+    // Node 0 is the root, the rest start out free
+    trie[0].parent = -1;
+    trie_free = -1;
+    for (int i = TRIE_NODES - 1; i > 0; i--)
+    {
+        trie[i].next = trie_free;
+        trie_free = i;
+    }
     
-    // Calc jumps
-    for (int i = 0; i < PATTERNS_MATCH_SIZE + PATTERNS_PREDICT_SIZE; i++)
+    for (int i = PATTERNS_STORED_SIZE - 1; i >= 0; i--)
     {
-        int history_i = PATTERNS_MATCH_SIZE + PATTERNS_PREDICT_SIZE - i - 1;
-        (*pat).jumps[i] = history_get(history_i).mem_addr - history_get(history_i+1).mem_addr;
+        trie_insert(i);
     }
 }
 
-void pattern_pad(Pattern *pat, int padding)
+//=========
+// Ranking
+//=========
+
+// Aging is lazy: every epoch costs each pattern one point, settled when
+// the score is read. score + epoch is unaffected by aging, so a min-heap
+// on it keeps the worst pattern on top without touching the whole table.
+
+int32_t *ranking;     // Heap of pattern ids
+int32_t *ranking_pos; // Heap position of each pattern
+
+int32_t pattern_score(int32_t pat_id)
+{
+    return patterns_stored[pat_id].score - (patterns_epoch - patterns_stored[pat_id].epoch);
+}
+
+int ranking_less(int32_t a, int32_t b)
 {
-    if (VERBOSE) printf("pattern_pad()\n");
+    int32_t key_a = patterns_stored[a].score + patterns_stored[a].epoch;
+    int32_t key_b = patterns_stored[b].score + patterns_stored[b].epoch;
+    return key_a < key_b || (key_a == key_b && a < b);
+}
+
+void ranking_swap(int i, int j)
+{
+    int32_t tmp = ranking[i];
+    ranking[i] = ranking[j];
+    ranking[j] = tmp;
+    ranking_pos[ranking[i]] = i;
+    ranking_pos[ranking[j]] = j;
+}
 
-    for (int i = 0; i < PATTERNS_MATCH_SIZE + PATTERNS_PREDICT_SIZE-padding; i++)
+// Restore heap order after the score of a pattern changed
+void ranking_update(int32_t pat_id)
+{
+    int i = ranking_pos[pat_id];
+    while (i > 0 && ranking_less(ranking[i], ranking[(i - 1) / 2]))
     {
-        pat->jumps[i] = pat->jumps[i+padding];
+        ranking_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
     }
-    for (int i = PATTERNS_MATCH_SIZE + PATTERNS_PREDICT_SIZE-padding; i < PATTERNS_MATCH_SIZE + PATTERNS_PREDICT_SIZE; i++)
+    while (1)
     {
-        pat->jumps[i] = 0;
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = 2 * i + 2;
+        if (left < PATTERNS_STORED_SIZE && ranking_less(ranking[left], ranking[smallest]))
+            smallest = left;
+        if (right < PATTERNS_STORED_SIZE && ranking_less(ranking[right], ranking[smallest]))
+            smallest = right;
+        if (smallest == i)
+            break;
+        ranking_swap(i, smallest);
+        i = smallest;
     }
 }
 
-void pattern_worst(int32_t *pat_id)
+void ranking_init(void)
+{
+    // All scores start equal, so ascending ids already form a heap
+    ranking = (int32_t*) malloc(sizeof(int32_t) * PATTERNS_STORED_SIZE);
+    ranking_pos = (int32_t*) malloc(sizeof(int32_t) * PATTERNS_STORED_SIZE);
+    for (int i = 0; i < PATTERNS_STORED_SIZE; i++)
+    {
+        ranking[i] = i;
+        ranking_pos[i] = i;
+    }
+}
+
+void patterns_init(void)
+{
+    LOG_TRACE("patterns_init()\n");
+    
+    // Allocate memory
+    patterns_stored = (Pattern*) calloc(sizeof(Pattern), PATTERNS_STORED_SIZE);
+    index_init();
+    trie_init();
+    ranking_init();
+}
+
+void pattern_match(int32_t *jumps, int32_t *pat_id, int32_t *pat_score)
+{
+    LOG_TRACE("pattern_match()\n");
+
+    // Longest common prefix
+    trie_match(jumps, pat_id, pat_score);
+    
+    LOG_TRACE("best:\n");
+    LOG_TRACE("-id:%d\n", *pat_id);
+    LOG_TRACE("-score:%d\n", *pat_score);
+}
+
+void pattern_match_perfect(int32_t *jumps, int32_t *pat_id)
+{
+    LOG_TRACE("pattern_match_perfect()\n");
+    
+    // Look up in index
+    *pat_id = index_find(jumps);
+    if (*pat_id >= 0) LOG_TRACE("-found:%d\n", *pat_id);
+}
+
+void pattern_current(Pattern *pat)
 {
-    if (VERBOSE) printf("pattern_worst()\n");
+    LOG_TRACE("pattern_current()\n");
     
-    // Find pattern with lowest score
-    int32_t lowest_i = 0;
-    int32_t lowest_score = patterns_stored[0].score;
-    for (int i = 1; i < PATTERNS_STORED_SIZE; i++)
+    (*pat).score = 1;
+    (*pat).epoch = patterns_epoch;
+    
+    // Copy jumps
+    for (int i = 0; i < PATTERNS_MATCH_SIZE + PATTERNS_PREDICT_SIZE; i++)
     {
-        if (patterns_stored[i].score < lowest_score)
-        {
-            lowest_score = patterns_stored[i].score;
-            lowest_i = i;
-        }
+        (*pat).jumps[i] = history_jumps[i];
     }
-    *pat_id = lowest_i;
+}
 
-    if (VERBOSE) printf("-id:%d\n", lowest_i);
-    if (VERBOSE) printf("-score:%d\n", lowest_score);
+void pattern_store(int32_t pat_id)
+{
+    LOG_TRACE("pattern_store()\n");
+    
+    // Overwrite with current, keeping lookups in sync
+    index_remove(pat_id);
+    trie_remove(pat_id);
+    pattern_current(&patterns_stored[pat_id]);
+    index_insert(pat_id);
+    trie_insert(pat_id);
+    ranking_update(pat_id);
+}
+
+void pattern_worst(int32_t *pat_id)
+{
+    LOG_TRACE("pattern_worst()\n");
+    
+    // Pattern with lowest score is on top
+    *pat_id = ranking[0];
+
+    LOG_TRACE("-id:%d\n", *pat_id);
+    LOG_TRACE("-score:%d\n", pattern_score(*pat_id));
 }
 
 void pattern_check(void)
 {
-    if (VERBOSE) printf("pattern_check()\n");
+    LOG_TRACE("pattern_check()\n");
     
-    // Get
-    Pattern pat;
-    pattern_current(&pat);
-    pattern_pad(&pat, PATTERNS_PREDICT_SIZE);
+    // Current pattern padded, read in place
+    int32_t *pat = &history_jumps[PATTERNS_PREDICT_SIZE];
     
     // Best match
     int32_t id;
     int32_t score;
-    pattern_match(&pat, &id, &score);
+    pattern_match(pat, &id, &score);
     
     // Predict
     if (score > 1)
     {
-        Pattern pat_match = patterns_stored[id];
-        Addr addr = history_get(0).mem_addr;
+        Pattern *pat_match = &patterns_stored[id];
+        Addr addr = history_get(0);
+        TRACE(TRACE_MATCH, addr, PATTERNS_PREDICT_SIZE);
         for (int i = PATTERNS_MATCH_SIZE; i < PATTERNS_MATCH_SIZE + PATTERNS_PREDICT_SIZE; i++)
         {
-            addr += pat_match.jumps[i];  
+            addr += (*pat_match).jumps[i];  
             prefetch_if_not_cached(addr);
-            if (VERBOSE) printf("-prefetching\n");
+            LOG_TRACE("-prefetching\n");
         }
     }
     
     // Check for perfect match
     int32_t id_perfect;
-    pattern_match_perfect(&pat, &id_perfect);
+    pattern_match_perfect(pat, &id_perfect);
     
     if (id_perfect < 0)
     {
         // Overwrite worst
         int32_t id_worst;
         pattern_worst(&id_worst);
-        pattern_current(&patterns_stored[id_worst]);
-        if (VERBOSE) printf("-replacing:%d\n", id_worst);
+        pattern_store(id_worst);
+        LOG_TRACE("-replacing:%d\n", id_worst);
     }
     else
     {
         // Increase score
         patterns_stored[id_perfect].score++;
-        if (VERBOSE) printf("-incrementing\n");
+        ranking_update(id_perfect);
+        trie_promote(id_perfect);
+        LOG_TRACE("-incrementing\n");
     }
 }
 
 void patterns_age(void)
 {
-    if (VERBOSE) printf("patterns_age()\n");
+    LOG_TRACE("patterns_age()\n");
     
-    // Check for match
-    for (int i = 0; i < PATTERNS_STORED_SIZE; i++)
-    {
-        if (VERBOSE) printf("-(%d:%d)\n", i, patterns_stored[i].score);
-        patterns_stored[i].score--;
-    }
+    // Scores decay when read
+    patterns_epoch++;
+    LOG_TRACE("-epoch:%d\n", patterns_epoch);
+    TRACE_FLUSH();
 }
 
 //===========
@@ -237,6 +548,7 @@ void patterns_age(void)
 
 void prefetch_init(void)
 {
+    TRACE_INIT();
     history_init();
     patterns_init();
 }
@@ -246,7 +558,7 @@ int counter = 0;
 void prefetch_access(AccessStat stat)
 {
     // Store statistics
-    history_store(stat);
+    history_store(stat.mem_addr);
     
     pattern_check();
     
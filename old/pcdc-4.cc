@@ -1,4 +1,5 @@
 #include "interface.hh"
+#include "log.hh"
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -6,7 +7,8 @@
 // For GHB sizes up to 2048, KB_SIZE+GHB_SIZE can be 1680 (8KB) : 28+11 bits per line
 
 // Magic Numbers
-#define VERBOSE 1
+#define LOG_LEVEL 1
+#define TRACE_ENABLED 0
 #define CALIBRATION_INTERVAL (2*1024)
 #define KB_SIZE 512
 #define GHB_SIZE 1024
@@ -20,7 +22,7 @@
 
 // Prototypes
 void prefetcher_init();
-void prefetcher_access(AccessStat stat);
+void prefetcher_access(AccessStat stat, int prefetch_hit);
 void prefetcher_delta_correlate();
 void prefetcher_calibrate();
 
@@ -63,6 +65,7 @@ void issue_if_needed(Addr addr)
     if (!in_cache(addr) && !in_mshr_queue(addr) && 0 <= addr && addr < MAX_PHYS_MEM_ADDR)
     {
         issue_prefetch(addr);
+        TRACE(TRACE_ISSUE, addr, 0);
     }
 }
 
@@ -74,6 +77,7 @@ int counter = 0;
 
 void prefetch_init()
 {
+    TRACE_INIT();
     stats_reset();
     prefetcher_init();
 }
@@ -89,14 +93,15 @@ void prefetch_access(AccessStat stat)
         stat_read_hits++;
     }
     
-    // Count hits on prefetched blocks
-    if (!stat.miss && get_prefetch_bit(stat.mem_addr))
+    // Count hits on prefetched blocks (first touch only, the tag is cleared below)
+    int prefetch_hit = !stat.miss && get_prefetch_bit(stat.mem_addr);
+    if (prefetch_hit)
     {
         stat_issued_hits++;
     }
     
     // Run prefetcher logic
-    prefetcher_access(stat);
+    prefetcher_access(stat, prefetch_hit);
     
     // Clear prefetch tag
     clear_prefetch_bit(stat.mem_addr);
@@ -137,7 +142,7 @@ void kb_init(int size)
     kb_size = size;
     kb = (KB_Entry*) calloc(sizeof(KB_Entry), size);
     int bytes = sizeof(KB_Entry)*size;
-    if (VERBOSE >= 1) printf("KB initialized to %d rows (%d bytes)\n", size, bytes);
+    LOG_INFO("KB initialized to %d rows (%d bytes)\n", size, bytes);
 }
 
 void kb_store(KB_Key key, KB_Index index)
@@ -145,7 +150,7 @@ void kb_store(KB_Key key, KB_Index index)
     kb_head = (kb_head + 1) % kb_size;
     kb[kb_head].key = key;
     kb[kb_head].index = index;
-    if (VERBOSE >= 3) printf("KB[%d] now stores [%d,%d]\n", kb_head, key, index);
+    LOG_TRACE("KB[%d] now stores [%d,%d]\n", kb_head, key, index);
 }
 
 //=======================
@@ -169,7 +174,7 @@ void ghb_init(int size)
     ghb_size = size;
     ghb = (GHB_Entry*) calloc(sizeof(GHB_Entry), size);
     int bytes = sizeof(GHB_Entry)*size;
-    if (VERBOSE >= 1) printf("GHB initialized to %d rows (%d bytes)\n", size, bytes);
+    LOG_INFO("GHB initialized to %d rows (%d bytes)\n", size, bytes);
 }
 
 void ghb_store(GHB_Address address, GHB_Index previous)
@@ -177,7 +182,8 @@ void ghb_store(GHB_Address address, GHB_Index previous)
     ghb_head = (ghb_head + 1) % ghb_size;
     ghb[ghb_head].address = address;
     ghb[ghb_head].previous = previous;
-    if (VERBOSE >= 3) printf("GHB[%d] now stores [%d,%d]\n", ghb_head, address, previous);
+    TRACE(TRACE_STORE, address, ghb_head);
+    LOG_TRACE("GHB[%d] now stores [%d,%d]\n", ghb_head, address, previous);
 }
 
 //============
@@ -193,10 +199,10 @@ void prefetcher_init(void)
     ghb_init(GHB_SIZE);
 }
 
-void prefetcher_access(AccessStat stat)
+void prefetcher_access(AccessStat stat, int prefetch_hit)
 {
-    // Exit if not miss
-    if (!stat.miss && STORE_MISSES_ONLY)
+    // Exit if not miss, but keep training on prefetched streams
+    if (!stat.miss && !prefetch_hit && STORE_MISSES_ONLY)
     {
         return;
     }
@@ -304,6 +310,8 @@ void prefetcher_delta_correlate()
             }
             if (match)
             {
+                TRACE(TRACE_MATCH, address, prefetch_degree);
+                
                 // Prefetch
                 for (int k = 0; k < prefetch_degree; k++)
                 {
@@ -311,7 +319,7 @@ void prefetcher_delta_correlate()
                     issue_if_needed(address);
                     buffer_i = (buffer_i - 1 + buffer_size) % buffer_size;
                 }
-                if (VERBOSE >= 2) printf("Prefetching blocks! (degree %d)\n", prefetch_degree);
+                LOG_DEBUG("Prefetching blocks! (degree %d)\n", prefetch_degree);
                 break;
             }
         }
@@ -320,15 +328,16 @@ void prefetcher_delta_correlate()
 
 void prefetcher_calibrate()
 {
-    if (VERBOSE >= 1)
+    if (LOG_ENABLED(1))
     {
-        printf("[] Calibrating...\n");
-        printf(" - PFD: %d\n", prefetch_degree);
-        printf(" - Hit rate: %d\n", (int) stats_hit_rate());
-        printf(" - Issued hit rate: %d\n", (int) stats_issued_hit_rate());
+        LOG_INFO("[] Calibrating...\n");
+        LOG_INFO(" - PFD: %d\n", prefetch_degree);
+        LOG_INFO(" - Hit rate: %d\n", (int) stats_hit_rate());
+        LOG_INFO(" - Issued hit rate: %d\n", (int) stats_issued_hit_rate());
     }
     
     // Reset stats
     stats_reset();
+    TRACE_FLUSH();
 }
 
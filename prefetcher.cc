@@ -1,37 +1,246 @@
 #include "interface.hh"
+#include "log.hh"
 #include <stdlib.h>
 #include <stdio.h>
 
 /* Bits per entry: 28*3 + b*n + roof(sqrt(n)) where b = bits/delta and n = deltas/entry */
 /* b = 16, n = 16 gives 344 bits (43 bytes) which allows 188 rows (8096 B / 43 B = 188.28) */
+/* Cross page adds 30 bits (47 bytes per row). Stream 116 B, pending 160 B and controller 8 B */
+/* are on by default too, which leaves 7812 B, 166 rows. Components with bigger tables default to off */
 
 /* Magic Numbers */
-#define VERBOSE 1
+#define LOG_LEVEL 1
+#define TRACE_ENABLED 0
 #define CALIBRATION_INTERVAL (1024)
 #define RATE_FACTOR 1000000
-#define DCPT_SIZE 180
+#define DCPT_SIZE 166
 #define DCPT_DELTAS 16
 #define DCPT_DELTA_BITS 16
 #define DCPT_DELTA_DISCARD_BITS 4 /* 2^4 = 32, block size is 64 */
 #define DCPT_DELTA_MAX ((1 << (DCPT_DELTA_BITS - 1)) - 1)
 #define DCPT_DELTA_MIN (0 - DCPT_DELTA_MAX)
-#define DCPT_DISCARD_ENABLED 0
-#define DCPT_PARTIAL_MASK_BITS 10
+#define DCPT_DISCARD_ENABLED 0 /* Starting value, the controller may change it */
+#define DCPT_TRAIN_FILTER_ENABLED 1 /* Train on misses and first-touch prefetch hits only */
+#define DCPT_PARTIAL_MASK_BITS 10 /* Partial matches ignore this many low bits of each delta */
 #define DCPT_PARTIAL_MASK ((1 << DCPT_PARTIAL_MASK_BITS)-1)
-#define PREFETCH_DEGREE_MAX 3
-#define PREFETCH_DEGREE_PARTIAL_MAX 2
+#define DCPT_PAGE_BITS 12 /* Candidates stop at the page boundary, 4 KB pages */
+#define DCPT_CROSS_PAGE_ENABLED 1 /* Let confident PCs continue into the next page, adds 28 + 2 bits per entry */
+#define DCPT_CROSS_PAGE_MAX 3
+#define DCPT_CROSS_PAGE_THRESHOLD 2
+
+/* Feedback directed prefetching: DCPT aggressiveness levels picked from accuracy, lateness and pollution */
+#define FDP_ENABLED 1
+#define FDP_LEVELS 5
+#define FDP_LEVEL_START 2 /* Degree 3, partial degree 2, as before FDP */
+#define FDP_ACCURACY_HIGH 750000 /* Rates are in parts of RATE_FACTOR */
+#define FDP_ACCURACY_LOW 400000
+#define FDP_LATENESS_HIGH 10000 /* Late share of useful prefetches */
+#define FDP_POLLUTION_HIGH 5000 /* Share of demand misses caused by prefetches */
+#define FDP_SAMPLES_MIN 32 /* Fewer completed or useful prefetches than this say nothing */
+
+/* Pollution tracker: prefetches evicted unused, and demand misses on blocks prefetch fills evicted */
+/* Shadow sets mirror a sample of cache sets: 16 sets * (32 ways * 24 + 32 + 6 fill bits), victim Bloom filter: 4096 bits */
+#define POLLUTION_ENABLED 0 /* 2 KB, more than DCPT leaves, FDP then reads accuracy and lateness only */
+#define POLLUTION_SETS 1024 /* Low block bits, so a shadow set only holds blocks of one cache set */
+#define POLLUTION_SAMPLED_SETS 16
+#define POLLUTION_WAYS 32 /* At least the cache associativity */
+#define POLLUTION_FILLS 32 /* Fill kinds remembered per set until matched to a victim */
+#define POLLUTION_BLOOM_BITS 4096
+#define POLLUTION_BLOOM_INSERTS 64 /* Cleared after this many victims, keeps false positives near 0.1% */
+#define POLLUTION_SAMPLES_MIN 8 /* Counts are halved every calibration, not reset */
+
+/* Controller: owns the FDP level, partial matching and discard, and tries changes to them */
+#define CONTROLLER_ENABLED 1
+#define CONTROLLER_SEED 1 /* Same seed and samples, same decisions */
+#define CONTROLLER_COOLDOWN 8 /* Intervals between trials */
+#define CONTROLLER_EXPLORE_ODDS 4 /* One in this many intervals after a cooldown starts a trial */
+#define CONTROLLER_HYSTERESIS 10000 /* Score a trial must gain to be kept */
+#define CONTROLLER_INACCURACY_COST 2 /* Score is coverage minus inaccuracy over this */
+#define CONTROLLER_KNOB_NONE (-1)
+#define CONTROLLER_KNOB_PARTIAL 0
+#define CONTROLLER_KNOB_DISCARD 1
+#define CONTROLLER_KNOB_UP 2
+#define CONTROLLER_KNOB_DOWN 3
+#define CONTROLLER_KNOBS 4
+
+/* Multi-key GHB: one buffer threaded onto both a PC chain and a CZone chain */
+/* Bits per GHB entry: 28 + 2*9 = 46, per KB entry: 28 + 9 = 37 */
+#define GHB_ENABLED 0
+#define GHB_SIZE 512
+#define GHB_KB_SIZE 128
+#define GHB_MATCH_DEGREE 2
+#define GHB_LOOKBACK 32
+#define GHB_DEGREE 2
+#define GHB_CZONE_BITS 16
+#define GHB_PREDICTIONS 32 /* Recent predictions remembered per chain for accuracy */
+#define GHB_CHAIN_PC 0
+#define GHB_CHAIN_CZONE 1
+#define GHB_CHAINS 2
+
+/* Best-Offset: one global offset scored against recently completed prefetches */
+/* Recent requests table: 256 tags of 12 bits, plus 26 scores of 5 bits */
+#define BO_ENABLED 0
+#define BO_RR_SIZE 256
+#define BO_RR_TAG_BITS 12
+#define BO_OFFSETS 26
+#define BO_SCORE_MAX 31
+#define BO_ROUND_MAX 100
+#define BO_BAD_SCORE 1
+#define BO_DEGREE 1
+#define BO_PAGE_BLOCKS 64 /* Offsets stay within a 4 KB page */
+#define BO_ISSUED_SIZE 64 /* Own prefetches in flight: 13 bit tag + 6 bit offset */
+
+/* Signature Path Prefetcher: per-page delta signatures and a confidence-throttled lookahead */
+/* ST entry: 20 tag + 6 offset + 12 signature bits, PT entry: 4 + 4*(7+4) bits */
+#define SPP_ENABLED 0
+#define SPP_ST_SIZE 256
+#define SPP_PT_SIZE 512
+#define SPP_PT_DELTAS 4
+#define SPP_SIG_BITS 12
+#define SPP_SIG_SHIFT 3
+#define SPP_COUNTER_MAX 15
+#define SPP_THRESHOLD 25 /* Lookahead stops when path confidence drops below this percentage */
+#define SPP_DEPTH_MAX 16
+#define SPP_PAGE_BLOCKS 64
+
+/* Variable Length Delta Prefetcher: per-page delta history, tables keyed by 1, 2 and 3 deltas */
+#define VLDP_ENABLED 0
+#define VLDP_DHB_SIZE 16
+#define VLDP_OPT_SIZE 64
+#define VLDP_DPT_SIZE 64
+#define VLDP_HISTORY 3
+#define VLDP_ACCURACY_MAX 3
+#define VLDP_DEGREE 4
+#define VLDP_PAGE_BLOCKS 64
+
+/* Access Map Pattern Matching: per-zone access bitmaps, strides found around each access */
+/* Zone entry: 20 tag + 2*64 map bits */
+#define AMPM_ENABLED 0
+#define AMPM_ZONES 64
+#define AMPM_ZONE_BLOCKS 64 /* One bit per block in a 64 bit map */
+#define AMPM_STRIDE_MAX 16
+#define AMPM_DEGREE 4
+
+/* Spatial Memory Streaming: replay the footprint of a region when its trigger event recurs */
+/* History is Bingo style: looked up by PC+address first, then by PC+offset, in one table */
+/* AGT entry: 20 region + 28 PC + 6 offset + 64 footprint = 118 bits, 32 rows = 472 B */
+/* PHT entry: 16 long tag + 10 short tag + 64 footprint + 4 LRU = 94 bits, 640 rows = 7520 B */
+#define SMS_ENABLED 0
+#define SMS_REGION_BLOCKS 64 /* One bit per block in a 64 bit footprint */
+#define SMS_AGT_SIZE 32
+#define SMS_PHT_SETS 64
+#define SMS_PHT_WAYS 10
+#define SMS_PHT_LONG_BITS 16
+#define SMS_PHT_SHORT_BITS 10
+#define SMS_VOTE_PERCENT 50 /* Blocks replayed on a PC+offset match must be in this share of matches */
+
+/* Stream detector: claims sequential miss streams before they reach DCPT */
+/* Bits per entry: 2*22 block + 10 state + 4 LRU = 58 */
+#define STREAM_ENABLED 1
+#define STREAM_COUNT 16
+#define STREAM_WINDOW 16 /* Largest step, in blocks, that continues a stream when the blocks skipped are present */
+#define STREAM_CONFIRM 3 /* Monotonic steps before a direction is trusted */
+#define STREAM_DISTANCE_START 2
+#define STREAM_DISTANCE_MAX 16
+#define STREAM_DEGREE 4 /* Most blocks issued per access */
+
+/* Reference Prediction Table: first stage, PCs with a steady stride never reach DCPT */
+/* Bits per entry: 28 tag + 28 address + 16 stride + 2 state = 74 */
+#define RPT_ENABLED 0 /* 592 B, more than the 356 B DCPT leaves of the budget */
+#define RPT_SIZE 64
+#define RPT_DEGREE 4
+
+/* Temporal correlation: miss address -> next miss address, optionally per PC as in ISB */
+/* Bits per entry: 22 tag + 22 successor + 2 confidence + 2 LRU = 48, 1024 rows = 6 KB */
+#define TEMPORAL_ENABLED 0
+#define TEMPORAL_PC_LOCALIZED 1
+#define TEMPORAL_SETS 256
+#define TEMPORAL_WAYS 4
+#define TEMPORAL_LAST_SIZE 64 /* Last miss per PC */
+#define TEMPORAL_CONFIDENCE_MAX 3
+#define TEMPORAL_DEGREE 2
+
+/* Timeliness: DCPT starts far enough ahead that prefetches complete before the demand */
+/* Issue times: 64 * (22 block + 32 time) + 8 * 32 completion bits, per DCPT entry 2 * 32 time bits */
+#define TIMELY_ENABLED 0 /* 1.9 KB with the per entry times, more than DCPT leaves */
+#define TIMELY_SIZE 64
+#define TIMELY_COMPLETED_SIZE 8 /* Completions waiting for the next access */
+#define TIMELY_DISTANCE_MAX 12 /* Leaves room for a few of the DCPT_DELTAS candidates */
+#define TIMELY_SMOOTHING 3 /* Averages move 1/8 of the way to each sample */
+
+/* Pending buffer: candidates that found the prefetch queue full wait here for a free slot */
+/* Bits per entry: 22 block + 2 confidence + 16 time = 40, with the 16 owner bits of adaptive degree */
+/* and the 43 feature bits of the perceptron filter when those are on */
+#define PENDING_ENABLED 1
+#define PENDING_SIZE 32
+#define PENDING_AGE_MAX 64 /* Accesses a candidate may wait before it is too late to bother */
+
+/* Adaptive degree: DCPT and GHB entries keep a confidence counter that sets their own degree */
+/* Owners: 128 * (22 block + 16 entry) bits, per entry 4 counter bits */
+#define ADAPTIVE_ENABLED 0 /* 700 B with the per entry counters, more than DCPT leaves */
+#define ADAPTIVE_OWNERS 128
+#define ADAPTIVE_CONFIDENCE_MAX 15
+#define ADAPTIVE_CONFIDENCE_START 6 /* Degree 3, as before */
+#define ADAPTIVE_CONFIDENCE_STEP 3 /* Confidence per extra degree */
+
+/* Tournament: leader sets dedicated to DCPT, GHB and stride/stream, followers go to the winner */
+/* Leaders are 1 in TOURNAMENT_LEADER_RATIO sets per engine, scored by their demand misses */
+#define TOURNAMENT_ENABLED 0
+#define TOURNAMENT_SETS 1024
+#define TOURNAMENT_LEADER_RATIO 32
+#define TOURNAMENT_HYSTERESIS 10 /* Percent fewer misses a challenger needs to take over */
+#define TOURNAMENT_DCPT 0
+#define TOURNAMENT_GHB 1
+#define TOURNAMENT_STRIDE 2
+#define TOURNAMENT_ENGINES 3
+#define TOURNAMENT_ANY (-1) /* Side engines, not part of the duel */
+
+/* Perceptron filter: every candidate is scored on hashed features and dropped if predicted useless */
+/* Weights: 5 features * 128 * 5 bits = 400 B, issued/rejected rows: 26 block + 5*7 index + 8 sum bits */
+#define PERCEPTRON_ENABLED 0 /* 3.7 KB with its issued and rejected rows, more than DCPT leaves */
+#define PERCEPTRON_FEATURES 5
+#define PERCEPTRON_TABLE_SIZE 128
+#define PERCEPTRON_WEIGHT_MAX 15
+#define PERCEPTRON_WEIGHT_MIN (-16)
+#define PERCEPTRON_THRESHOLD 0 /* Issue when the sum is at least this */
+#define PERCEPTRON_MARGIN 12 /* Keep training on correct predictions closer than this */
+#define PERCEPTRON_ISSUED_SIZE 256
+#define PERCEPTRON_REJECTED_SIZE 128
+#define PERCEPTRON_CONFIDENCE_MAX 3 /* Engines report confidence on a 0 to 3 scale */
+#define PERCEPTRON_PAGE_BLOCKS 64 /* Page offset feature, 4 KB pages */
 
 /* Prototypes */
 void prefetcher_init();
-void prefetcher_access(AccessStat stat);
+void prefetcher_access(AccessStat stat, int prefetch_hit);
+void prefetcher_complete(Addr addr);
 void prefetcher_calibrate();
 
+/*=========*/
+/* Hashing */
+/*=========*/
+
+/* Slot of a block in a table indexed by its hash, so strided blocks spread over the whole table */
+int hash_slot(Addr block, int size)
+{
+    return ((block * 2654435761u) >> 12) % size;
+}
+
 /*============*/
 /* Statistics */
 /*============*/
 
+#define STAGE_RPT 0
+#define STAGE_STREAM 1
+#define STAGE_DCPT 2
+#define STAGES 3
+#define STAGE_PC_BITS 1024 /* Hashed PCs seen per stage, statistics only */
+
 int64_t stat_read, stat_read_hits;
 int64_t stat_issued, stat_issued_hits;
+int64_t stat_served[STAGES], stat_new_dcpt;
+uint8_t stat_served_pcs[STAGES][STAGE_PC_BITS / 8];
+int64_t stat_temporal_lookups, stat_temporal_found;
+int64_t stat_late;
 
 void stats_reset()
 {
@@ -39,6 +248,35 @@ void stats_reset()
     stat_read_hits = 1;
     stat_issued = 1;
     stat_issued_hits = 1;
+    for (int s = 0; s < STAGES; s++)
+    {
+        stat_served[s] = 0;
+        for (int i = 0; i < STAGE_PC_BITS / 8; i++) stat_served_pcs[s][i] = 0;
+    }
+    stat_new_dcpt = 0;
+    stat_temporal_lookups = 1;
+    stat_temporal_found = 0;
+    stat_late = 0;
+}
+
+/* Counts an access served by a stage, and the PC it came from */
+void stats_served(int stage, Addr pc)
+{
+    uint32_t bit = ((uint32_t) pc * 2654435761u) >> 16;
+    bit %= STAGE_PC_BITS;
+    stat_served[stage]++;
+    stat_served_pcs[stage][bit / 8] |= 1 << (bit % 8);
+}
+
+/* PCs a stage served, hashing makes this a slight undercount */
+int stats_served_pcs(int stage)
+{
+    int count = 0;
+    for (int i = 0; i < STAGE_PC_BITS; i++)
+    {
+        count += (stat_served_pcs[stage][i / 8] >> (i % 8)) & 1;
+    }
+    return count;
 }
 
 int64_t stats_hit_rate()
@@ -56,19 +294,486 @@ int64_t stats_rate(int64_t rate_a, int64_t rate_b)
     return (rate_a*RATE_FACTOR) / (rate_b);
 }
 
+/*============*/
+/* Timeliness */
+/*============*/
+
+typedef struct {
+    Addr block;
+    Tick time;
+} Timely_Entry;
+
+Timely_Entry timely_issued[TIMELY_SIZE];
+Tick timely_completed[TIMELY_COMPLETED_SIZE]; /* Issue times of prefetches completed since the last access */
+int timely_completed_count;
+Tick timely_now; /* Time of the current access, prefetches are issued at it */
+Tick timely_latency; /* Average time from issue to completion */
+
+void timely_init()
+{
+    timely_now = 0;
+    timely_latency = 0;
+    timely_completed_count = 0;
+    for (int i = 0; i < TIMELY_SIZE; i++)
+    {
+        timely_issued[i].block = 0;
+    }
+}
+
+Timely_Entry *timely_slot(Addr block)
+{
+    return &timely_issued[hash_slot(block, TIMELY_SIZE)];
+}
+
+/* Moves an average towards a sample */
+Tick timely_average(Tick average, Tick sample)
+{
+    if (average == 0) return sample;
+    return average + ((sample - average) >> TIMELY_SMOOTHING);
+}
+
+void timely_access(AccessStat stat)
+{
+    /* Completions carry no time, this access is the first we know to follow them */
+    for (int i = 0; i < timely_completed_count; i++)
+    {
+        timely_latency = timely_average(timely_latency, stat.time - timely_completed[i]);
+    }
+    timely_completed_count = 0;
+    timely_now = stat.time;
+}
+
+void timely_issue(Addr addr)
+{
+    Timely_Entry *entry = timely_slot(addr / BLOCK_SIZE);
+    entry->block = addr / BLOCK_SIZE;
+    entry->time = timely_now;
+}
+
+void timely_complete(Addr addr)
+{
+    Timely_Entry *entry = timely_slot(addr / BLOCK_SIZE);
+    if (entry->block != addr / BLOCK_SIZE) return;
+    if (timely_completed_count < TIMELY_COMPLETED_SIZE)
+    {
+        timely_completed[timely_completed_count++] = entry->time;
+    }
+    entry->block = 0;
+}
+
+/* Candidates to skip so the first one issued arrives in time, given the time between accesses */
+int timely_distance(Tick interval)
+{
+    if (interval <= 0 || timely_latency <= interval) return 0;
+    int distance = (timely_latency + interval - 1) / interval - 1;
+    return distance < TIMELY_DISTANCE_MAX ? distance : TIMELY_DISTANCE_MAX;
+}
+
+/*=================*/
+/* Adaptive degree */
+/*=================*/
+
+typedef int8_t Adaptive_Confidence;
+
+/* An issued prefetch and the confidence of the entry that asked for it */
+typedef struct {
+    Addr block;
+    Adaptive_Confidence *owner;
+} Adaptive_Owner;
+
+Adaptive_Owner adaptive_owners[ADAPTIVE_OWNERS];
+Adaptive_Confidence *adaptive_owner; /* Entry currently generating candidates, NULL for none */
+
+void adaptive_init()
+{
+    adaptive_owner = NULL;
+    for (int i = 0; i < ADAPTIVE_OWNERS; i++)
+    {
+        adaptive_owners[i].owner = NULL;
+    }
+}
+
+Adaptive_Owner *adaptive_slot(Addr block)
+{
+    return &adaptive_owners[hash_slot(block, ADAPTIVE_OWNERS)];
+}
+
+void adaptive_train(Adaptive_Confidence *confidence, int useful)
+{
+    if (useful && *confidence < ADAPTIVE_CONFIDENCE_MAX) (*confidence)++;
+    if (!useful && *confidence > 0) (*confidence)--;
+}
+
+/* Degree of an entry, within the cap set by the global controller */
+int adaptive_degree(Adaptive_Confidence confidence, int cap)
+{
+    if (!ADAPTIVE_ENABLED) return cap;
+    int degree = 1 + confidence / ADAPTIVE_CONFIDENCE_STEP;
+    return degree < cap ? degree : cap;
+}
+
+/* Credits the owner of a demanded prefetch */
+void adaptive_access(AccessStat stat, int prefetch_hit)
+{
+    Addr block = stat.mem_addr / BLOCK_SIZE;
+    Adaptive_Owner *slot = adaptive_slot(block);
+    if (slot->owner != NULL && slot->block == block && (prefetch_hit || stat.miss))
+    {
+        adaptive_train(slot->owner, 1);
+        slot->owner = NULL;
+    }
+}
+
+/* Remembers who issued a prefetch, blaming the owner of the one it replaces if that left the cache unused */
+void adaptive_issue(Addr addr)
+{
+    Addr block = addr / BLOCK_SIZE;
+    Adaptive_Owner *slot = adaptive_slot(block);
+    if (slot->owner != NULL)
+    {
+        Addr old = slot->block * BLOCK_SIZE;
+        if (!in_cache(old) && !in_mshr_queue(old))
+        {
+            adaptive_train(slot->owner, 0);
+        }
+    }
+    slot->block = block;
+    slot->owner = adaptive_owner;
+}
+
 /*=========*/
 /* Helpers */
 /*=========*/
 
-void issue_if_needed(Addr addr)
+#define ISSUE_SKIPPED 0 /* Already present, or out of range */
+#define ISSUE_DONE 1
+#define ISSUE_FULL 2 /* Prefetch queue full, try again later */
+
+/* Whether a prefetch of addr would do anything */
+int issue_needed(Addr addr)
+{
+    return !in_cache(addr) && !in_mshr_queue(addr) && addr < MAX_PHYS_MEM_ADDR;
+}
+
+int issue_if_needed(Addr addr)
+{
+    if (!issue_needed(addr))
+    {
+        return ISSUE_SKIPPED;
+    }
+    if (current_queue_size() >= MAX_QUEUE_SIZE)
+    {
+        return ISSUE_FULL;
+    }
+    issue_prefetch(addr);
+    if (TIMELY_ENABLED) timely_issue(addr);
+    if (ADAPTIVE_ENABLED && adaptive_owner != NULL) adaptive_issue(addr);
+    TRACE(TRACE_ISSUE, addr, 0);
+    LOG_DEBUG("Prefetch issued for address %d\n", (int)addr);
+    return ISSUE_DONE;
+}
+
+/*============*/
+/* Tournament */
+/*============*/
+
+int tournament_engine = TOURNAMENT_ANY; /* Engine currently generating candidates */
+int tournament_winner = TOURNAMENT_DCPT;
+int64_t tournament_misses[TOURNAMENT_ENGINES];
+
+void tournament_init()
+{
+    tournament_winner = TOURNAMENT_DCPT;
+    for (int i = 0; i < TOURNAMENT_ENGINES; i++)
+    {
+        tournament_misses[i] = 0;
+    }
+}
+
+/* Engine leading the set of a block, or TOURNAMENT_ANY for follower sets */
+int tournament_leader(Addr addr)
+{
+    uint32_t set = (addr / BLOCK_SIZE) % TOURNAMENT_SETS;
+    int sample = ((set * 2654435761u) >> 8) % TOURNAMENT_LEADER_RATIO;
+    return sample < TOURNAMENT_ENGINES ? sample : TOURNAMENT_ANY;
+}
+
+/* Leaders only take prefetches from their own engine, followers from the winner */
+int tournament_allows(Addr addr)
+{
+    if (tournament_engine == TOURNAMENT_ANY) return 1;
+    int leader = tournament_leader(addr);
+    if (leader == TOURNAMENT_ANY) return tournament_engine == tournament_winner;
+    return tournament_engine == leader;
+}
+
+void tournament_access(AccessStat stat)
+{
+    int leader = tournament_leader(stat.mem_addr);
+    if (stat.miss && leader != TOURNAMENT_ANY)
+    {
+        tournament_misses[leader]++;
+    }
+}
+
+/* Picks the leader with the fewest misses, then ages the counts */
+void tournament_calibrate()
+{
+    int best = tournament_winner;
+    for (int i = 0; i < TOURNAMENT_ENGINES; i++)
+    {
+        if (tournament_misses[i] < tournament_misses[best]) best = i;
+    }
+    int64_t margin = tournament_misses[tournament_winner] * TOURNAMENT_HYSTERESIS / 100;
+    if (tournament_misses[best] + margin < tournament_misses[tournament_winner])
+    {
+        tournament_winner = best;
+    }
+    for (int i = 0; i < TOURNAMENT_ENGINES; i++)
+    {
+        tournament_misses[i] /= 2;
+    }
+}
+
+/*===================*/
+/* Perceptron filter */
+/*===================*/
+
+typedef int8_t Perceptron_Weight;
+typedef uint8_t Perceptron_Index;
+
+/* A scored candidate, kept until its outcome is known */
+typedef struct {
+    Addr block;
+    Perceptron_Index index[PERCEPTRON_FEATURES];
+    int16_t sum;
+    int8_t valid;
+} Perceptron_Entry;
+
+Perceptron_Weight perceptron_weights[PERCEPTRON_FEATURES][PERCEPTRON_TABLE_SIZE];
+Perceptron_Entry perceptron_issued[PERCEPTRON_ISSUED_SIZE];
+Perceptron_Entry perceptron_rejected[PERCEPTRON_REJECTED_SIZE];
+AccessStat perceptron_trigger; /* Access the engines are generating candidates for */
+
+void perceptron_init()
+{
+    for (int f = 0; f < PERCEPTRON_FEATURES; f++)
+    {
+        for (int i = 0; i < PERCEPTRON_TABLE_SIZE; i++)
+        {
+            perceptron_weights[f][i] = 0;
+        }
+    }
+    for (int i = 0; i < PERCEPTRON_ISSUED_SIZE; i++)
+    {
+        perceptron_issued[i].valid = 0;
+    }
+    for (int i = 0; i < PERCEPTRON_REJECTED_SIZE; i++)
+    {
+        perceptron_rejected[i].valid = 0;
+    }
+}
+
+Perceptron_Entry *perceptron_slot(Perceptron_Entry *table, int size, Addr block)
+{
+    return &table[hash_slot(block, size)];
+}
+
+Perceptron_Index perceptron_hash(int64_t value)
+{
+    uint64_t hash = (uint64_t) value * 2654435761u;
+    return (hash ^ (hash >> 16)) % PERCEPTRON_TABLE_SIZE;
+}
+
+/* Sums the weights of the features, indices are written to entry */
+int perceptron_score(Perceptron_Entry *entry, Addr block, int depth, int confidence)
+{
+    Addr trigger = perceptron_trigger.mem_addr / BLOCK_SIZE;
+    entry->index[0] = perceptron_hash(perceptron_trigger.pc);
+    entry->index[1] = perceptron_hash((int64_t) block - (int64_t) trigger);
+    entry->index[2] = block % PERCEPTRON_PAGE_BLOCKS;
+    entry->index[3] = depth < PERCEPTRON_TABLE_SIZE ? depth : PERCEPTRON_TABLE_SIZE - 1;
+    entry->index[4] = confidence;
+    int sum = 0;
+    for (int f = 0; f < PERCEPTRON_FEATURES; f++)
+    {
+        sum += perceptron_weights[f][entry->index[f]];
+    }
+    return sum;
+}
+
+/* Moves the weights towards the outcome unless the prediction was right by a margin */
+void perceptron_train(Perceptron_Entry *entry, int useful)
+{
+    if (useful && entry->sum >= PERCEPTRON_THRESHOLD + PERCEPTRON_MARGIN) return;
+    if (!useful && entry->sum < PERCEPTRON_THRESHOLD - PERCEPTRON_MARGIN) return;
+    for (int f = 0; f < PERCEPTRON_FEATURES; f++)
+    {
+        Perceptron_Weight *weight = &perceptron_weights[f][entry->index[f]];
+        if (useful && *weight < PERCEPTRON_WEIGHT_MAX) (*weight)++;
+        if (!useful && *weight > PERCEPTRON_WEIGHT_MIN) (*weight)--;
+    }
+    LOG_TRACE("Perceptron trained %s for block %d (sum %d)\n", useful ? "up" : "down", (int) entry->block, entry->sum);
+}
+
+/* Learns from a demand access: prefetches that were used, and rejections that were wrong */
+void perceptron_access(AccessStat stat, int prefetch_hit)
+{
+    Addr block = stat.mem_addr / BLOCK_SIZE;
+    perceptron_trigger = stat;
+    
+    Perceptron_Entry *issued = perceptron_slot(perceptron_issued, PERCEPTRON_ISSUED_SIZE, block);
+    if (issued->valid && issued->block == block && (prefetch_hit || stat.miss))
+    {
+        perceptron_train(issued, 1);
+        issued->valid = 0;
+    }
+    Perceptron_Entry *rejected = perceptron_slot(perceptron_rejected, PERCEPTRON_REJECTED_SIZE, block);
+    if (rejected->valid && rejected->block == block && stat.miss)
+    {
+        perceptron_train(rejected, 1);
+        rejected->valid = 0;
+    }
+}
+
+/* Tracks an issued candidate, the prefetch it replaces was never demanded and if it left the cache it was useless */
+void perceptron_issue(Perceptron_Entry *candidate)
+{
+    Perceptron_Entry *slot = perceptron_slot(perceptron_issued, PERCEPTRON_ISSUED_SIZE, candidate->block);
+    if (slot->valid)
+    {
+        Addr old = slot->block * BLOCK_SIZE;
+        if (!in_cache(old) && !in_mshr_queue(old))
+        {
+            perceptron_train(slot, 0);
+        }
+    }
+    *slot = *candidate;
+}
+
+/*=========*/
+/* Pending */
+/*=========*/
+
+typedef struct {
+    Addr addr;
+    int8_t confidence;
+    int8_t valid;
+    int32_t time;
+    Adaptive_Confidence *owner; /* Entry that asked for it, credited once it is issued */
+    Perceptron_Entry candidate; /* Features it was scored with, invalid when not scored */
+} Pending_Entry;
+
+Pending_Entry pending[PENDING_SIZE];
+int32_t pending_time;
+
+void pending_init()
+{
+    pending_time = 0;
+    for (int i = 0; i < PENDING_SIZE; i++)
+    {
+        pending[i].valid = 0;
+    }
+}
+
+/* Lower is evicted first: stale entries, then low confidence, then old */
+int pending_priority(Pending_Entry *entry)
+{
+    if (!entry->valid) return -1;
+    int age = pending_time - entry->time;
+    if (age > PENDING_AGE_MAX) return 0;
+    return 1 + entry->confidence * (PENDING_AGE_MAX + 1) + PENDING_AGE_MAX - age;
+}
+
+/* Holds a candidate the prefetch queue had no room for, with its owner and perceptron features if scored */
+void pending_insert(Addr addr, int confidence, Perceptron_Entry *candidate)
+{
+    Pending_Entry *victim = &pending[0];
+    for (int i = 0; i < PENDING_SIZE; i++)
+    {
+        if (pending[i].valid && pending[i].addr == addr)
+        {
+            /* A repeat keeps the more confident request */
+            if (pending[i].confidence > confidence)
+            {
+                pending[i].time = pending_time;
+                return;
+            }
+            victim = &pending[i];
+            break;
+        }
+        if (pending_priority(&pending[i]) < pending_priority(victim)) victim = &pending[i];
+    }
+    victim->addr = addr;
+    victim->confidence = confidence;
+    victim->valid = 1;
+    victim->time = pending_time;
+    victim->owner = adaptive_owner;
+    victim->candidate.valid = 0;
+    if (candidate != NULL) victim->candidate = *candidate;
+}
+
+/* Issues waiting candidates, best first, while the queue has room */
+void pending_drain()
 {
-    if (!in_cache(addr) && !in_mshr_queue(addr)
-        && 0 <= addr && addr < MAX_PHYS_MEM_ADDR
-        && current_queue_size() < MAX_QUEUE_SIZE)
+    pending_time++;
+    while (current_queue_size() < MAX_QUEUE_SIZE)
+    {
+        Pending_Entry *best = NULL;
+        for (int i = 0; i < PENDING_SIZE; i++)
+        {
+            int priority = pending_priority(&pending[i]);
+            if (priority == 0) pending[i].valid = 0;
+            if (priority > 0 && (best == NULL || priority > pending_priority(best))) best = &pending[i];
+        }
+        if (best == NULL) return;
+        best->valid = 0;
+        adaptive_owner = best->owner;
+        if (issue_if_needed(best->addr) == ISSUE_DONE && best->candidate.valid)
+        {
+            perceptron_issue(&best->candidate);
+        }
+        adaptive_owner = NULL;
+    }
+}
+
+/*============*/
+/* Candidates */
+/*============*/
+
+/* Scores a candidate and issues it if it looks useful, depth counts from 0 and confidence is 0 to 3 */
+void issue_candidate(Addr addr, int depth, int confidence)
+{
+    if (TOURNAMENT_ENABLED && !tournament_allows(addr))
+    {
+        return;
+    }
+    if (!PERCEPTRON_ENABLED)
+    {
+        if (issue_if_needed(addr) == ISSUE_FULL && PENDING_ENABLED) pending_insert(addr, confidence, NULL);
+        return;
+    }
+    
+    /* Only candidates that would be issued are worth a prediction */
+    if (!issue_needed(addr))
+    {
+        return;
+    }
+    
+    Addr block = addr / BLOCK_SIZE;
+    Perceptron_Entry candidate;
+    candidate.block = block;
+    candidate.valid = 1;
+    candidate.sum = perceptron_score(&candidate, block, depth, confidence);
+    if (candidate.sum < PERCEPTRON_THRESHOLD)
     {
-        issue_prefetch(addr);
-        if (VERBOSE >= 2) printf("Prefetch issued for address %d\n", (int)addr);
+        *perceptron_slot(perceptron_rejected, PERCEPTRON_REJECTED_SIZE, block) = candidate;
+        LOG_DEBUG("Perceptron rejected address %d (sum %d)\n", (int) addr, candidate.sum);
+        return;
     }
+    int status = issue_if_needed(addr);
+    if (status == ISSUE_FULL && PENDING_ENABLED) pending_insert(addr, confidence, &candidate);
+    if (status == ISSUE_DONE) perceptron_issue(&candidate);
 }
 
 /*===========*/
@@ -79,6 +784,7 @@ int counter = 0;
 
 void prefetch_init()
 {
+    TRACE_INIT();
     stats_reset();
     prefetcher_init();
 }
@@ -87,6 +793,7 @@ void prefetch_access(AccessStat stat)
 {
     /* Count reads */
     stat_read++;
+    TRACE(TRACE_ACCESS, stat.mem_addr, (uint32_t) stat.pc);
     
     /* Count hits */
     if (!stat.miss) 
@@ -94,14 +801,15 @@ void prefetch_access(AccessStat stat)
         stat_read_hits++;
     }
     
-    /* Count hits on prefetched blocks */
-    if (!stat.miss && get_prefetch_bit(stat.mem_addr))
+    /* Count hits on prefetched blocks (first touch only, the tag is cleared below) */
+    int prefetch_hit = !stat.miss && get_prefetch_bit(stat.mem_addr);
+    if (prefetch_hit)
     {
         stat_issued_hits++;
     }
     
     /* Run prefetcher logic */
-    prefetcher_access(stat);
+    prefetcher_access(stat, prefetch_hit);
     
     /* Clear prefetch tag */
     clear_prefetch_bit(stat.mem_addr);
@@ -119,6 +827,10 @@ void prefetch_complete(Addr addr)
     /* Tag block as prefetched */
     set_prefetch_bit(addr);
     stat_issued++;
+    TRACE(TRACE_COMPLETE, addr, 0);
+    
+    /* Run prefetcher logic */
+    prefetcher_complete(addr);
 }
 
 /*======*/
@@ -136,11 +848,18 @@ typedef struct {
     DCPT_Addr last_prefetch;
     DCPT_Delta delta[DCPT_DELTAS];
     DCPT_Index delta_head;
+    DCPT_Addr cross_candidate; /* First candidate past the page boundary, 0 when resolved */
+    int8_t cross_confidence;
+    Tick last_time;
+    Tick interval; /* Average time between accesses */
+    Adaptive_Confidence confidence; /* Sets this PC's degree */
 } DCPT_Entry;
 
 int dcpt_head;
 int dcpt_size;
 DCPT_Entry *dcpt;
+int dcpt_partial = 1; /* Fall back to partial matching */
+int dcpt_discard = DCPT_DISCARD_ENABLED;
 DCPT_Addr dcpt_candidates[DCPT_DELTAS];
 
 /* Initializes table */
@@ -167,6 +886,11 @@ DCPT_Entry *dcpt_new(DCPT_PC pc, DCPT_Addr addr)
         entry->delta[i] = 0;
     }
     entry->delta_head = 0;
+    entry->cross_candidate = 0;
+    entry->cross_confidence = 0;
+    entry->last_time = 0;
+    entry->interval = 0;
+    entry->confidence = ADAPTIVE_CONFIDENCE_START;
     
     return entry;
 }
@@ -197,6 +921,46 @@ void dcpt_delta_store(DCPT_Entry *entry, DCPT_Delta delta)
     entry->delta[entry->delta_head] = delta;
 }
 
+DCPT_Addr dcpt_page(DCPT_Addr addr)
+{
+    return addr >> DCPT_PAGE_BITS;
+}
+
+/* Whether a candidate may be prefetched, candidates past the page boundary need a confident PC */
+int dcpt_page_allows(DCPT_Entry *entry, DCPT_Addr addr)
+{
+    if (dcpt_page(addr) == dcpt_page(entry->last_address)) return 1;
+    if (!DCPT_CROSS_PAGE_ENABLED) return 0;
+    if (entry->cross_candidate == 0) entry->cross_candidate = addr;
+    return entry->cross_confidence >= DCPT_CROSS_PAGE_THRESHOLD;
+}
+
+/* Scores the last cross page candidate once the PC leaves the page or reaches the candidate's page */
+void dcpt_cross_train(DCPT_Entry *entry, DCPT_Addr addr)
+{
+    if (entry->cross_candidate == 0) return;
+    if (dcpt_page(addr) == dcpt_page(entry->cross_candidate))
+    {
+        if (entry->cross_confidence < DCPT_CROSS_PAGE_MAX) entry->cross_confidence++;
+        entry->cross_candidate = 0;
+    }
+    else if (dcpt_page(addr) != dcpt_page(entry->last_address))
+    {
+        if (entry->cross_confidence > 0) entry->cross_confidence--;
+        entry->cross_candidate = 0;
+    }
+}
+
+/*
+ * Steps taken over the i matched deltas. That is one pass, unless timely
+ * lookahead needs more candidates and goes round them again. Discard can
+ * restart the candidates every pass, so the steps are bounded either way.
+ */
+int dcpt_steps(int i)
+{
+    return TIMELY_ENABLED ? DCPT_DELTAS + i : i;
+}
+
 /* Finds candidate prefetch addresses */
 /* Returns number of candidates */
 int dcpt_candidates_find(DCPT_Entry *entry)
@@ -214,17 +978,19 @@ int dcpt_candidates_find(DCPT_Entry *entry)
             
             DCPT_Addr addr = entry->last_address;
             
-            for (int k = 0; k < i; k++)
+            /* The matched deltas repeat every i, timely lookahead keeps going round them */
+            for (int k = 0; k < dcpt_steps(i) && x < DCPT_DELTAS; k++)
             {
-                DCPT_Delta delta = dcpt_delta_get(entry, i-k-1);
+                DCPT_Delta delta = dcpt_delta_get(entry, i - k%i - 1);
                 if (delta == 0) break; /* Overflow */
                 
                 /* Add candidate */
                 addr += delta << DCPT_DELTA_DISCARD_BITS;
+                if (!dcpt_page_allows(entry, addr)) break;
                 dcpt_candidates[x++] = addr;
                 
                 /* Discard all candidates if previous prefetch found */
-                if (addr == entry->last_prefetch && DCPT_DISCARD_ENABLED)
+                if (addr == entry->last_prefetch && dcpt_discard)
                 {
                     x = 0;
                 }
@@ -243,27 +1009,30 @@ int dcpt_candidates_find_partial(DCPT_Entry *entry)
     DCPT_Delta delta_b = dcpt_delta_get(entry, 1);
     if (delta_a == 0 || delta_b == 0) return 0; /* Overflow */
     
+    /* Setting the masked bits on both sides compares the high bits only */
     for (int i = 1; i < DCPT_DELTAS-1; i++)
     {
-        if (dcpt_delta_get(entry, i) | DCPT_PARTIAL_MASK == delta_a | DCPT_PARTIAL_MASK &&
-            dcpt_delta_get(entry, i+1) | DCPT_PARTIAL_MASK == delta_b | DCPT_PARTIAL_MASK)
+        if ((dcpt_delta_get(entry, i) | DCPT_PARTIAL_MASK) == (delta_a | DCPT_PARTIAL_MASK) &&
+            (dcpt_delta_get(entry, i+1) | DCPT_PARTIAL_MASK) == (delta_b | DCPT_PARTIAL_MASK))
         {
             /* Number of candidates */
             int x = 0;
             
             DCPT_Addr addr = entry->last_address;
             
-            for (int k = 0; k < i; k++)
+            /* The matched deltas repeat every i, timely lookahead keeps going round them */
+            for (int k = 0; k < dcpt_steps(i) && x < DCPT_DELTAS; k++)
             {
-                DCPT_Delta delta = dcpt_delta_get(entry, i-k-1);
+                DCPT_Delta delta = dcpt_delta_get(entry, i - k%i - 1);
                 if (delta == 0) break; /* Overflow */
                 
                 /* Add candidate */
                 addr += delta << DCPT_DELTA_DISCARD_BITS;
+                if (!dcpt_page_allows(entry, addr)) break;
                 dcpt_candidates[x++] = addr;
                 
                 /* Discard all candidates if previous prefetch found */
-                if (addr == entry->last_prefetch && DCPT_DISCARD_ENABLED)
+                if (addr == entry->last_prefetch && dcpt_discard)
                 {
                     x = 0;
                 }
@@ -273,19 +1042,1829 @@ int dcpt_candidates_find_partial(DCPT_Entry *entry)
     }
     return 0;
 }
-/*============*/
-/* Prefetcher */
-/*============*/
+/*===============*/
+/* Multi-key GHB */
+/*===============*/
 
-void prefetcher_init()
-{
-    dcpt_init(DCPT_SIZE);
-}
+typedef int32_t GHB_Key;
+typedef int32_t GHB_Address;
+typedef int16_t GHB_Index;
 
-void prefetcher_access(AccessStat stat)
-{
-    /* Get data */
-    DCPT_Addr pc = stat.pc;
+typedef struct {
+    GHB_Key key;
+    GHB_Index index;
+    Adaptive_Confidence confidence; /* Sets this key's degree */
+} GHB_KB_Entry;
+
+typedef struct {
+    GHB_Address address;
+    GHB_Index previous[GHB_CHAINS];
+} GHB_Entry;
+
+GHB_Entry *ghb;
+GHB_Index ghb_head;
+GHB_KB_Entry *ghb_kb[GHB_CHAINS];
+int ghb_kb_head[GHB_CHAINS];
+GHB_Address ghb_candidates[GHB_CHAINS][GHB_DEGREE];
+
+/* Recent predictions and their outcome, per chain */
+GHB_Address ghb_predicted[GHB_CHAINS][GHB_PREDICTIONS];
+int ghb_predicted_head[GHB_CHAINS];
+int64_t ghb_predictions[GHB_CHAINS];
+int64_t ghb_useful[GHB_CHAINS];
+
+/* Initializes buffer and key tables */
+void ghb_init()
+{
+    ghb_head = -1;
+    ghb = (GHB_Entry*) calloc(sizeof(GHB_Entry), GHB_SIZE);
+    for (int c = 0; c < GHB_CHAINS; c++)
+    {
+        ghb_kb_head[c] = -1;
+        ghb_kb[c] = (GHB_KB_Entry*) calloc(sizeof(GHB_KB_Entry), GHB_KB_SIZE);
+        for (int i = 0; i < GHB_KB_SIZE; i++)
+        {
+            ghb_kb[c][i].index = -1;
+            ghb_kb[c][i].confidence = ADAPTIVE_CONFIDENCE_START;
+        }
+        ghb_predicted_head[c] = 0;
+        ghb_predictions[c] = 1;
+        ghb_useful[c] = 0;
+    }
+}
+
+/* Find the key table entry for a chain, creating it if missing */
+GHB_KB_Entry *ghb_kb_get(int chain, GHB_Key key)
+{
+    for (int i = 0; i < GHB_KB_SIZE; i++)
+    {
+        if (ghb_kb[chain][i].key == key)
+        {
+            return &ghb_kb[chain][i];
+        }
+    }
+    
+    /* Grab next entry (FIFO) */
+    ghb_kb_head[chain] = (ghb_kb_head[chain] + 1) % GHB_KB_SIZE;
+    GHB_KB_Entry *entry = &ghb_kb[chain][ghb_kb_head[chain]];
+    entry->key = key;
+    entry->index = -1;
+    entry->confidence = ADAPTIVE_CONFIDENCE_START;
+    return entry;
+}
+
+/* Store a miss once and link it onto every chain */
+void ghb_store(GHB_Address address, GHB_Key keys[GHB_CHAINS])
+{
+    ghb_head = (ghb_head + 1) % GHB_SIZE;
+    ghb[ghb_head].address = address;
+    for (int c = 0; c < GHB_CHAINS; c++)
+    {
+        GHB_KB_Entry *entry = ghb_kb_get(c, keys[c]);
+        ghb[ghb_head].previous[c] = entry->index;
+        entry->index = ghb_head;
+    }
+}
+
+/* Delta correlation along one chain */
+/* Returns number of candidates */
+int ghb_candidates_find(int chain)
+{
+    GHB_Address deltas[GHB_LOOKBACK];
+    int n = 0;
+    
+    /* Collect deltas, newest first; stop at links the buffer has overwritten */
+    GHB_Index index = ghb_head;
+    int age = 0;
+    while (n < GHB_LOOKBACK)
+    {
+        GHB_Index previous = ghb[index].previous[chain];
+        if (previous == -1) break;
+        age += (index - previous + GHB_SIZE) % GHB_SIZE;
+        if (age >= GHB_SIZE) break; /* Stale */
+        deltas[n++] = ghb[index].address - ghb[previous].address;
+        index = previous;
+    }
+    
+    /* Find the most recent earlier occurrence of the newest delta pair */
+    for (int i = 1; i + GHB_MATCH_DEGREE <= n; i++)
+    {
+        int match = 1;
+        for (int k = 0; k < GHB_MATCH_DEGREE; k++)
+        {
+            if (deltas[i+k] != deltas[k])
+            {
+                match = 0;
+                break;
+            }
+        }
+        if (match)
+        {
+            /* Replay the deltas that followed it */
+            GHB_Address address = ghb[ghb_head].address;
+            for (int k = 0; k < GHB_DEGREE; k++)
+            {
+                address += deltas[i - 1 - (k % i)];
+                ghb_candidates[chain][k] = address;
+            }
+            return GHB_DEGREE;
+        }
+    }
+    return 0;
+}
+
+/* Credit a chain if it predicted this access */
+void ghb_predicted_check(GHB_Address address)
+{
+    GHB_Address block = address & ~(BLOCK_SIZE-1);
+    for (int c = 0; c < GHB_CHAINS; c++)
+    {
+        for (int i = 0; i < GHB_PREDICTIONS; i++)
+        {
+            if (ghb_predicted[c][i] == block)
+            {
+                ghb_predicted[c][i] = -1;
+                ghb_useful[c]++;
+                break;
+            }
+        }
+    }
+}
+
+/* Remember a prediction made by a chain */
+void ghb_predicted_store(int chain, GHB_Address address)
+{
+    GHB_Address block = address & ~(BLOCK_SIZE-1);
+    for (int i = 0; i < GHB_PREDICTIONS; i++)
+    {
+        if (ghb_predicted[chain][i] == block) return; /* Already pending */
+    }
+    ghb_predicted_head[chain] = (ghb_predicted_head[chain] + 1) % GHB_PREDICTIONS;
+    ghb_predicted[chain][ghb_predicted_head[chain]] = block;
+    ghb_predictions[chain]++;
+}
+
+/* Recent accuracy of a chain */
+int64_t ghb_accuracy(int chain)
+{
+    return stats_rate(ghb_useful[chain], ghb_predictions[chain]);
+}
+
+void ghb_access(AccessStat stat)
+{
+    /* Score earlier predictions */
+    ghb_predicted_check(stat.mem_addr);
+    
+    /* Store miss on both chains */
+    GHB_Key keys[GHB_CHAINS];
+    keys[GHB_CHAIN_PC] = stat.pc;
+    keys[GHB_CHAIN_CZONE] = stat.mem_addr >> GHB_CZONE_BITS;
+    ghb_store(stat.mem_addr, keys);
+    
+    /* Correlate on both chains, each key issuing up to its own degree */
+    int count[GHB_CHAINS];
+    GHB_KB_Entry *owner[GHB_CHAINS];
+    for (int c = 0; c < GHB_CHAINS; c++)
+    {
+        owner[c] = ghb_kb_get(c, keys[c]);
+        count[c] = ghb_candidates_find(c);
+        TRACE(TRACE_MATCH, stat.mem_addr, count[c]);
+        for (int i = 0; i < count[c]; i++)
+        {
+            ghb_predicted_store(c, ghb_candidates[c][i]);
+        }
+    }
+    
+    /* Issue the union if both agree, otherwise trust the more accurate chain */
+    int pc = GHB_CHAIN_PC;
+    int czone = GHB_CHAIN_CZONE;
+    if (count[pc] > 0 && count[czone] > 0 && ghb_candidates[pc][0] == ghb_candidates[czone][0])
+    {
+        for (int c = 0; c < GHB_CHAINS; c++)
+        {
+            adaptive_owner = &owner[c]->confidence;
+            for (int i = 0; i < count[c] && i < adaptive_degree(owner[c]->confidence, GHB_DEGREE); i++)
+            {
+                issue_candidate(ghb_candidates[c][i], i, PERCEPTRON_CONFIDENCE_MAX);
+            }
+        }
+        adaptive_owner = NULL;
+        return;
+    }
+    int best = ghb_accuracy(pc) >= ghb_accuracy(czone) ? pc : czone;
+    if (count[best] == 0)
+    {
+        best = best == pc ? czone : pc;
+    }
+    adaptive_owner = &owner[best]->confidence;
+    for (int i = 0; i < count[best] && i < adaptive_degree(owner[best]->confidence, GHB_DEGREE); i++)
+    {
+        issue_candidate(ghb_candidates[best][i], i, (int) (ghb_accuracy(best) * PERCEPTRON_CONFIDENCE_MAX / RATE_FACTOR));
+    }
+    adaptive_owner = NULL;
+}
+
+/* Age the accuracy counters so they follow program phases */
+void ghb_calibrate()
+{
+    for (int c = 0; c < GHB_CHAINS; c++)
+    {
+        ghb_predictions[c] = ghb_predictions[c] / 2 + 1;
+        ghb_useful[c] = ghb_useful[c] / 2;
+    }
+}
+
+/*=============*/
+/* Best-Offset */
+/*=============*/
+
+typedef uint32_t BO_Block;
+typedef uint16_t BO_Tag;
+
+/* Offsets in blocks with no prime factor above 5 */
+const int bo_offsets[BO_OFFSETS] = {
+    1, 2, 3, 4, 5, 6, 8, 9, 10, 12, 15, 16, 18,
+    20, 24, 25, 27, 30, 32, 36, 40, 45, 48, 50, 54, 60
+};
+
+/* A prefetch BO issued, and the offset it was issued with */
+typedef struct {
+    BO_Tag tag;
+    int8_t offset;
+} BO_Issued;
+
+BO_Tag bo_rr[BO_RR_SIZE];
+BO_Issued bo_issued[BO_ISSUED_SIZE];
+int bo_scores[BO_OFFSETS];
+int bo_test;
+int bo_round;
+int bo_offset;
+int bo_best_score;
+
+void bo_init()
+{
+    for (int i = 0; i < BO_OFFSETS; i++)
+    {
+        bo_scores[i] = 0;
+    }
+    for (int i = 0; i < BO_ISSUED_SIZE; i++)
+    {
+        bo_issued[i].tag = 0;
+    }
+    bo_test = 0;
+    bo_round = 0;
+    bo_offset = 1;
+    bo_best_score = 0;
+}
+
+int bo_rr_index(BO_Block block)
+{
+    return (block ^ (block >> 8)) % BO_RR_SIZE;
+}
+
+BO_Tag bo_rr_tag(BO_Block block)
+{
+    return (block & ((1 << BO_RR_TAG_BITS) - 1)) | (1 << BO_RR_TAG_BITS); /* Top bit marks valid */
+}
+
+void bo_rr_insert(BO_Block block)
+{
+    bo_rr[bo_rr_index(block)] = bo_rr_tag(block);
+}
+
+int bo_rr_contains(BO_Block block)
+{
+    return bo_rr[bo_rr_index(block)] == bo_rr_tag(block);
+}
+
+BO_Issued *bo_issued_slot(BO_Block block)
+{
+    return &bo_issued[(block ^ (block >> 6)) % BO_ISSUED_SIZE];
+}
+
+/* Pick the best offset of a learning phase and start the next one */
+void bo_phase_end()
+{
+    int best = 0;
+    for (int i = 1; i < BO_OFFSETS; i++)
+    {
+        if (bo_scores[i] > bo_scores[best])
+        {
+            best = i;
+        }
+    }
+    bo_best_score = bo_scores[best];
+    bo_offset = bo_best_score > BO_BAD_SCORE ? bo_offsets[best] : 0;
+    
+    for (int i = 0; i < BO_OFFSETS; i++)
+    {
+        bo_scores[i] = 0;
+    }
+    bo_test = 0;
+    bo_round = 0;
+}
+
+/* A block was requested in time if it is in the table, so score one offset per access */
+void bo_learn(BO_Block block)
+{
+    int i = bo_test;
+    if (bo_rr_contains(block - bo_offsets[i]) && ++bo_scores[i] >= BO_SCORE_MAX)
+    {
+        bo_phase_end();
+        return;
+    }
+    
+    if (++bo_test == BO_OFFSETS)
+    {
+        bo_test = 0;
+        if (++bo_round == BO_ROUND_MAX)
+        {
+            bo_phase_end();
+        }
+    }
+}
+
+void bo_access(AccessStat stat)
+{
+    BO_Block block = stat.mem_addr / BLOCK_SIZE;
+    
+    bo_learn(block);
+    
+    /* Without prefetches completing, the table learns from misses directly */
+    if (bo_offset == 0 && stat.miss)
+    {
+        bo_rr_insert(block);
+    }
+    
+    /* Prefetch along the best offset, within the page */
+    for (int k = 1; k <= BO_DEGREE && bo_offset != 0; k++)
+    {
+        BO_Block target = block + k * bo_offset;
+        if (target / BO_PAGE_BLOCKS != block / BO_PAGE_BLOCKS) break;
+        BO_Issued *issued = bo_issued_slot(target);
+        issued->tag = bo_rr_tag(target);
+        issued->offset = k * bo_offset;
+        issue_candidate((Addr) target * BLOCK_SIZE, k - 1, bo_best_score * PERCEPTRON_CONFIDENCE_MAX / BO_SCORE_MAX);
+    }
+}
+
+/* Remember the access that triggered a completed prefetch, if it was one of ours */
+void bo_complete(Addr addr)
+{
+    BO_Block block = addr / BLOCK_SIZE;
+    BO_Issued *issued = bo_issued_slot(block);
+    if (issued->tag == bo_rr_tag(block))
+    {
+        bo_rr_insert(block - issued->offset);
+        issued->tag = 0;
+    }
+}
+
+/*=====*/
+/* SPP */
+/*=====*/
+
+typedef uint32_t SPP_Page;
+typedef uint16_t SPP_Signature;
+typedef int8_t SPP_Delta;
+
+typedef struct {
+    SPP_Page page;
+    int8_t valid;
+    int8_t last_offset;
+    SPP_Signature signature;
+} SPP_ST_Entry;
+
+typedef struct {
+    uint8_t count;
+    SPP_Delta delta[SPP_PT_DELTAS];
+    uint8_t delta_count[SPP_PT_DELTAS];
+} SPP_PT_Entry;
+
+SPP_ST_Entry *spp_st;
+SPP_PT_Entry *spp_pt;
+
+void spp_init()
+{
+    spp_st = (SPP_ST_Entry*) calloc(sizeof(SPP_ST_Entry), SPP_ST_SIZE);
+    spp_pt = (SPP_PT_Entry*) calloc(sizeof(SPP_PT_Entry), SPP_PT_SIZE);
+}
+
+/* Fold a delta into a signature */
+SPP_Signature spp_signature_next(SPP_Signature signature, SPP_Delta delta)
+{
+    return ((signature << SPP_SIG_SHIFT) ^ (delta & 0x7F)) & ((1 << SPP_SIG_BITS) - 1);
+}
+
+SPP_PT_Entry *spp_pt_get(SPP_Signature signature)
+{
+    return &spp_pt[signature % SPP_PT_SIZE];
+}
+
+/* Count a delta following a signature */
+void spp_pt_update(SPP_Signature signature, SPP_Delta delta)
+{
+    SPP_PT_Entry *entry = spp_pt_get(signature);
+    
+    /* Find delta, or replace the weakest one */
+    int slot = 0;
+    for (int i = 0; i < SPP_PT_DELTAS; i++)
+    {
+        if (entry->delta[i] == delta && entry->delta_count[i] > 0)
+        {
+            slot = i;
+            break;
+        }
+        if (entry->delta_count[i] < entry->delta_count[slot])
+        {
+            slot = i;
+        }
+    }
+    if (entry->delta[slot] != delta)
+    {
+        entry->delta[slot] = delta;
+        entry->delta_count[slot] = 0;
+    }
+    entry->delta_count[slot]++;
+    entry->count++;
+    
+    /* Halve all counters on saturation to keep ratios */
+    if (entry->count > SPP_COUNTER_MAX || entry->delta_count[slot] > SPP_COUNTER_MAX)
+    {
+        entry->count /= 2;
+        for (int i = 0; i < SPP_PT_DELTAS; i++)
+        {
+            entry->delta_count[i] /= 2;
+        }
+    }
+}
+
+/* Walk the signature path while compound confidence stays high enough */
+void spp_lookahead(SPP_Page page, int offset, SPP_Signature signature)
+{
+    int confidence = 100;
+    for (int depth = 0; depth < SPP_DEPTH_MAX; depth++)
+    {
+        SPP_PT_Entry *entry = spp_pt_get(signature);
+        if (entry->count == 0) break;
+        
+        /* Prefetch every confident delta, follow the strongest */
+        int best = -1;
+        int best_confidence = 0;
+        for (int i = 0; i < SPP_PT_DELTAS; i++)
+        {
+            if (entry->delta_count[i] == 0) continue;
+            int delta_confidence = confidence * entry->delta_count[i] / entry->count;
+            if (delta_confidence < SPP_THRESHOLD) continue;
+            
+            int target = offset + entry->delta[i];
+            if (target < 0 || target >= SPP_PAGE_BLOCKS) continue;
+            issue_candidate(((Addr) page * SPP_PAGE_BLOCKS + target) * BLOCK_SIZE, depth, delta_confidence * PERCEPTRON_CONFIDENCE_MAX / 100);
+            
+            if (delta_confidence > best_confidence)
+            {
+                best = i;
+                best_confidence = delta_confidence;
+            }
+        }
+        if (best == -1) break;
+        
+        offset += entry->delta[best];
+        signature = spp_signature_next(signature, entry->delta[best]);
+        confidence = best_confidence;
+    }
+}
+
+void spp_access(AccessStat stat)
+{
+    Addr block = stat.mem_addr / BLOCK_SIZE;
+    SPP_Page page = block / SPP_PAGE_BLOCKS;
+    int offset = block % SPP_PAGE_BLOCKS;
+    
+    /* Find page, start tracking it if missing */
+    SPP_ST_Entry *entry = &spp_st[page % SPP_ST_SIZE];
+    if (!entry->valid || entry->page != page)
+    {
+        entry->valid = 1;
+        entry->page = page;
+        entry->last_offset = offset;
+        entry->signature = 0;
+        return;
+    }
+    
+    SPP_Delta delta = offset - entry->last_offset;
+    if (delta == 0) return;
+    
+    /* Train, then move along the path */
+    spp_pt_update(entry->signature, delta);
+    entry->signature = spp_signature_next(entry->signature, delta);
+    entry->last_offset = offset;
+    
+    spp_lookahead(page, offset, entry->signature);
+}
+
+/*======*/
+/* VLDP */
+/*======*/
+
+typedef uint32_t VLDP_Page;
+typedef int8_t VLDP_Delta;
+typedef uint32_t VLDP_Key;
+
+/* Delta history buffer entry, one per recently touched page */
+typedef struct {
+    VLDP_Page page;
+    int8_t valid;
+    int8_t last_offset;
+    int8_t deltas; /* Number of valid deltas */
+    VLDP_Delta delta[VLDP_HISTORY]; /* Newest first */
+    uint32_t used;
+} VLDP_DHB_Entry;
+
+/* Prediction entry, used by the offset and delta prediction tables */
+typedef struct {
+    VLDP_Key key;
+    int8_t valid;
+    VLDP_Delta prediction;
+    int8_t accuracy;
+    uint32_t used;
+} VLDP_Prediction;
+
+VLDP_DHB_Entry vldp_dhb[VLDP_DHB_SIZE];
+VLDP_Prediction vldp_opt[VLDP_OPT_SIZE];
+VLDP_Prediction vldp_dpt[VLDP_HISTORY][VLDP_DPT_SIZE]; /* Table k is keyed by k+1 deltas */
+uint32_t vldp_time;
+
+void vldp_init()
+{
+    vldp_time = 0;
+}
+
+/* Pack the newest count deltas into a key */
+VLDP_Key vldp_key(VLDP_Delta *delta, int count)
+{
+    VLDP_Key key = 0;
+    for (int i = 0; i < count; i++)
+    {
+        key |= (VLDP_Key) (uint8_t) delta[i] << (8 * i);
+    }
+    return key;
+}
+
+VLDP_Prediction *vldp_dpt_find(int table, VLDP_Key key)
+{
+    for (int i = 0; i < VLDP_DPT_SIZE; i++)
+    {
+        if (vldp_dpt[table][i].valid && vldp_dpt[table][i].key == key)
+        {
+            return &vldp_dpt[table][i];
+        }
+    }
+    return NULL;
+}
+
+/* Train one prediction entry on the delta that actually followed */
+void vldp_prediction_update(VLDP_Prediction *entry, VLDP_Delta delta)
+{
+    if (entry->prediction == delta)
+    {
+        if (entry->accuracy < VLDP_ACCURACY_MAX) entry->accuracy++;
+    }
+    else if (entry->accuracy > 0)
+    {
+        entry->accuracy--;
+    }
+    else
+    {
+        entry->prediction = delta;
+    }
+    entry->used = vldp_time;
+}
+
+void vldp_dpt_train(int table, VLDP_Key key, VLDP_Delta delta)
+{
+    VLDP_Prediction *entry = vldp_dpt_find(table, key);
+    if (entry == NULL)
+    {
+        /* Replace least recently used */
+        entry = &vldp_dpt[table][0];
+        for (int i = 1; i < VLDP_DPT_SIZE && entry->valid; i++)
+        {
+            if (!vldp_dpt[table][i].valid || vldp_dpt[table][i].used < entry->used)
+            {
+                entry = &vldp_dpt[table][i];
+            }
+        }
+        entry->valid = 1;
+        entry->key = key;
+        entry->prediction = delta;
+        entry->accuracy = 0;
+    }
+    vldp_prediction_update(entry, delta);
+}
+
+/* Predict the next delta from the longest matching history */
+/* Returns 0 if there is no prediction */
+VLDP_Delta vldp_predict(VLDP_Delta *delta, int count)
+{
+    for (int k = count; k > 0; k--)
+    {
+        VLDP_Prediction *entry = vldp_dpt_find(k - 1, vldp_key(delta, k));
+        if (entry != NULL && (entry->accuracy > 0 || k == 1))
+        {
+            return entry->prediction;
+        }
+    }
+    return 0;
+}
+
+VLDP_DHB_Entry *vldp_dhb_find(VLDP_Page page)
+{
+    for (int i = 0; i < VLDP_DHB_SIZE; i++)
+    {
+        if (vldp_dhb[i].valid && vldp_dhb[i].page == page)
+        {
+            return &vldp_dhb[i];
+        }
+    }
+    return NULL;
+}
+
+/* Start tracking a page in place of the least recently used one */
+VLDP_DHB_Entry *vldp_dhb_new(VLDP_Page page, int offset)
+{
+    VLDP_DHB_Entry *victim = &vldp_dhb[0];
+    for (int i = 1; i < VLDP_DHB_SIZE && victim->valid; i++)
+    {
+        if (!vldp_dhb[i].valid || vldp_dhb[i].used < victim->used)
+        {
+            victim = &vldp_dhb[i];
+        }
+    }
+    victim->valid = 1;
+    victim->page = page;
+    victim->last_offset = offset;
+    victim->deltas = 0;
+    victim->used = vldp_time;
+    return victim;
+}
+
+void vldp_access(AccessStat stat)
+{
+    Addr block = stat.mem_addr / BLOCK_SIZE;
+    VLDP_Page page = block / VLDP_PAGE_BLOCKS;
+    int offset = block % VLDP_PAGE_BLOCKS;
+    vldp_time++;
+    
+    /* First touch of a page: only the offset table knows anything */
+    VLDP_DHB_Entry *entry = vldp_dhb_find(page);
+    if (entry == NULL)
+    {
+        vldp_dhb_new(page, offset);
+        VLDP_Prediction *first = &vldp_opt[offset];
+        int target = offset + first->prediction;
+        if (first->valid && first->accuracy > 0 && target >= 0 && target < VLDP_PAGE_BLOCKS)
+        {
+            issue_candidate(((Addr) page * VLDP_PAGE_BLOCKS + target) * BLOCK_SIZE, 0, first->accuracy);
+        }
+        return;
+    }
+    entry->used = vldp_time;
+    
+    VLDP_Delta delta = offset - entry->last_offset;
+    if (delta == 0) return;
+    
+    /* Train every table the history is long enough for */
+    if (entry->deltas == 0)
+    {
+        VLDP_Prediction *opt = &vldp_opt[entry->last_offset];
+        if (!opt->valid)
+        {
+            opt->valid = 1;
+            opt->prediction = delta;
+            opt->accuracy = 0;
+        }
+        vldp_prediction_update(opt, delta);
+    }
+    for (int k = 1; k <= entry->deltas; k++)
+    {
+        vldp_dpt_train(k - 1, vldp_key(entry->delta, k), delta);
+    }
+    
+    /* Store delta */
+    for (int i = VLDP_HISTORY - 1; i > 0; i--)
+    {
+        entry->delta[i] = entry->delta[i-1];
+    }
+    entry->delta[0] = delta;
+    if (entry->deltas < VLDP_HISTORY) entry->deltas++;
+    entry->last_offset = offset;
+    
+    /* Predict ahead on a copy of the history */
+    VLDP_Delta history[VLDP_HISTORY];
+    for (int i = 0; i < VLDP_HISTORY; i++)
+    {
+        history[i] = entry->delta[i];
+    }
+    int count = entry->deltas;
+    for (int d = 0; d < VLDP_DEGREE; d++)
+    {
+        VLDP_Delta next = vldp_predict(history, count);
+        if (next == 0) break;
+        
+        offset += next;
+        if (offset < 0 || offset >= VLDP_PAGE_BLOCKS) break;
+        issue_candidate(((Addr) page * VLDP_PAGE_BLOCKS + offset) * BLOCK_SIZE, d, 2);
+        
+        for (int i = VLDP_HISTORY - 1; i > 0; i--)
+        {
+            history[i] = history[i-1];
+        }
+        history[0] = next;
+        if (count < VLDP_HISTORY) count++;
+    }
+}
+
+/*======*/
+/* AMPM */
+/*======*/
+
+typedef uint32_t AMPM_Zone;
+typedef uint64_t AMPM_Map;
+
+typedef struct {
+    AMPM_Zone zone;
+    int8_t valid;
+    AMPM_Map accessed;
+    AMPM_Map prefetched; /* Prefetched and not accessed yet */
+    uint32_t used;
+} AMPM_Entry;
+
+AMPM_Entry ampm[AMPM_ZONES];
+uint32_t ampm_time;
+
+void ampm_init()
+{
+    ampm_time = 0;
+}
+
+/* Find a zone, replacing the least recently used one if missing */
+AMPM_Entry *ampm_get(AMPM_Zone zone)
+{
+    AMPM_Entry *victim = &ampm[0];
+    for (int i = 0; i < AMPM_ZONES; i++)
+    {
+        if (ampm[i].valid && ampm[i].zone == zone)
+        {
+            return &ampm[i];
+        }
+        if (!ampm[i].valid || (victim->valid && ampm[i].used < victim->used))
+        {
+            victim = &ampm[i];
+        }
+    }
+    victim->valid = 1;
+    victim->zone = zone;
+    victim->accessed = 0;
+    victim->prefetched = 0;
+    return victim;
+}
+
+/* Bit of a map, with everything outside the zone unset */
+int ampm_bit(AMPM_Map map, int offset)
+{
+    return offset >= 0 && offset < AMPM_ZONE_BLOCKS && ((map >> offset) & 1);
+}
+
+/* Prefetch a block of the zone unless it was touched already */
+int ampm_issue(AMPM_Entry *entry, int offset, int depth)
+{
+    if (offset < 0 || offset >= AMPM_ZONE_BLOCKS) return 0;
+    AMPM_Map bit = (AMPM_Map) 1 << offset;
+    if ((entry->accessed | entry->prefetched) & bit) return 0;
+    entry->prefetched |= bit;
+    issue_candidate(((Addr) entry->zone * AMPM_ZONE_BLOCKS + offset) * BLOCK_SIZE, depth, 2);
+    return 1;
+}
+
+void ampm_access(AccessStat stat)
+{
+    Addr block = stat.mem_addr / BLOCK_SIZE;
+    AMPM_Zone zone = block / AMPM_ZONE_BLOCKS;
+    int t = block % AMPM_ZONE_BLOCKS;
+    
+    /* Mark access */
+    AMPM_Entry *entry = ampm_get(zone);
+    entry->used = ++ampm_time;
+    entry->accessed |= (AMPM_Map) 1 << t;
+    entry->prefetched &= ~((AMPM_Map) 1 << t);
+    
+    /* Stride k holds if t-k and t-2k were accessed, in whichever order they came */
+    int issued = 0;
+    for (int k = 1; k <= AMPM_STRIDE_MAX && issued < AMPM_DEGREE; k++)
+    {
+        if (ampm_bit(entry->accessed, t - k) && ampm_bit(entry->accessed, t - 2*k))
+        {
+            issued += ampm_issue(entry, t + k, issued);
+        }
+        if (ampm_bit(entry->accessed, t + k) && ampm_bit(entry->accessed, t + 2*k) && issued < AMPM_DEGREE)
+        {
+            issued += ampm_issue(entry, t - k, issued);
+        }
+    }
+}
+
+/*=====*/
+/* SMS */
+/*=====*/
+
+typedef uint32_t SMS_Region;
+typedef uint64_t SMS_Footprint;
+typedef uint32_t SMS_Key;
+
+/* Active generation: a region being recorded */
+typedef struct {
+    SMS_Region region;
+    int8_t valid;
+    int8_t offset; /* Trigger offset */
+    Addr pc;       /* Trigger PC */
+    SMS_Footprint footprint;
+    uint32_t used;
+} SMS_AGT_Entry;
+
+/* Pattern history: footprints of ended generations */
+/* The set comes from the short (PC+offset) event, so both events of a trigger share it */
+typedef struct {
+    uint16_t long_tag;
+    uint16_t short_tag;
+    int8_t valid;
+    SMS_Footprint footprint;
+    uint32_t used;
+} SMS_PHT_Entry;
+
+SMS_AGT_Entry sms_agt[SMS_AGT_SIZE];
+SMS_PHT_Entry sms_pht[SMS_PHT_SETS][SMS_PHT_WAYS];
+uint32_t sms_time;
+
+void sms_init()
+{
+    sms_time = 0;
+}
+
+/* Short event: PC+offset, mixed so the set index (low bits) depends on the whole PC */
+SMS_Key sms_key_short(Addr pc, int offset)
+{
+    uint32_t key = (((uint32_t) pc << 6) ^ (uint32_t) (pc >> 26) ^ (uint32_t) offset) * 2654435761u;
+    return key ^ (key >> 16);
+}
+
+/* Long event: PC+address */
+SMS_Key sms_key_long(Addr pc, SMS_Region region, int offset)
+{
+    uint32_t address = region * SMS_REGION_BLOCKS + offset;
+    return (uint32_t) pc ^ (address * 2654435761u);
+}
+
+uint16_t sms_tag_short(SMS_Key key)
+{
+    return (key / SMS_PHT_SETS) & ((1 << SMS_PHT_SHORT_BITS) - 1);
+}
+
+uint16_t sms_tag_long(SMS_Key key)
+{
+    return (key ^ (key >> 16)) & ((1 << SMS_PHT_LONG_BITS) - 1);
+}
+
+/* Remember the footprint of an ended generation */
+void sms_pht_store(Addr pc, SMS_Region region, int offset, SMS_Footprint footprint)
+{
+    SMS_Key key = sms_key_short(pc, offset);
+    uint16_t short_tag = sms_tag_short(key);
+    uint16_t long_tag = sms_tag_long(sms_key_long(pc, region, offset));
+    SMS_PHT_Entry *set = sms_pht[key % SMS_PHT_SETS];
+    
+    /* Update the long event if present, else replace least recently used way */
+    SMS_PHT_Entry *entry = &set[0];
+    for (int i = 0; i < SMS_PHT_WAYS; i++)
+    {
+        if (set[i].valid && set[i].short_tag == short_tag && set[i].long_tag == long_tag)
+        {
+            entry = &set[i];
+            break;
+        }
+        if (entry->valid && (!set[i].valid || set[i].used < entry->used))
+        {
+            entry = &set[i];
+        }
+    }
+    entry->valid = 1;
+    entry->short_tag = short_tag;
+    entry->long_tag = long_tag;
+    entry->footprint = footprint;
+    entry->used = sms_time;
+}
+
+/* Footprint predicted for a new generation, 0 if none */
+SMS_Footprint sms_pht_lookup(Addr pc, SMS_Region region, int offset)
+{
+    SMS_Key key = sms_key_short(pc, offset);
+    uint16_t short_tag = sms_tag_short(key);
+    uint16_t long_tag = sms_tag_long(sms_key_long(pc, region, offset));
+    SMS_PHT_Entry *set = sms_pht[key % SMS_PHT_SETS];
+    
+    /* Long event: the exact footprint seen at this address */
+    for (int i = 0; i < SMS_PHT_WAYS; i++)
+    {
+        if (set[i].valid && set[i].short_tag == short_tag && set[i].long_tag == long_tag)
+        {
+            set[i].used = sms_time;
+            return set[i].footprint;
+        }
+    }
+    
+    /* Short event: blocks common to the footprints seen at this PC+offset */
+    int matches = 0;
+    int votes[SMS_REGION_BLOCKS] = {0};
+    for (int i = 0; i < SMS_PHT_WAYS; i++)
+    {
+        if (!set[i].valid || set[i].short_tag != short_tag) continue;
+        matches++;
+        for (int b = 0; b < SMS_REGION_BLOCKS; b++)
+        {
+            votes[b] += (set[i].footprint >> b) & 1;
+        }
+    }
+    SMS_Footprint footprint = 0;
+    for (int b = 0; b < SMS_REGION_BLOCKS && matches > 0; b++)
+    {
+        if (votes[b] * 100 >= matches * SMS_VOTE_PERCENT)
+        {
+            footprint |= (SMS_Footprint) 1 << b;
+        }
+    }
+    return footprint;
+}
+
+/* Start a generation, ending the least recently used one */
+SMS_AGT_Entry *sms_agt_new(SMS_Region region, Addr pc, int offset)
+{
+    SMS_AGT_Entry *victim = &sms_agt[0];
+    for (int i = 1; i < SMS_AGT_SIZE && victim->valid; i++)
+    {
+        if (!sms_agt[i].valid || sms_agt[i].used < victim->used)
+        {
+            victim = &sms_agt[i];
+        }
+    }
+    
+    /* Single access generations say nothing about the region */
+    if (victim->valid && (victim->footprint & (victim->footprint - 1)) != 0)
+    {
+        sms_pht_store(victim->pc, victim->region, victim->offset, victim->footprint);
+    }
+    
+    victim->valid = 1;
+    victim->region = region;
+    victim->pc = pc;
+    victim->offset = offset;
+    victim->footprint = 0;
+    return victim;
+}
+
+void sms_access(AccessStat stat)
+{
+    Addr block = stat.mem_addr / BLOCK_SIZE;
+    SMS_Region region = block / SMS_REGION_BLOCKS;
+    int offset = block % SMS_REGION_BLOCKS;
+    sms_time++;
+    
+    /* Accumulate into an active generation */
+    for (int i = 0; i < SMS_AGT_SIZE; i++)
+    {
+        if (sms_agt[i].valid && sms_agt[i].region == region)
+        {
+            sms_agt[i].footprint |= (SMS_Footprint) 1 << offset;
+            sms_agt[i].used = sms_time;
+            return;
+        }
+    }
+    
+    /* Trigger access: start recording and replay the footprint seen last time */
+    SMS_AGT_Entry *entry = sms_agt_new(region, stat.pc, offset);
+    entry->footprint = (SMS_Footprint) 1 << offset;
+    entry->used = sms_time;
+    
+    SMS_Footprint footprint = sms_pht_lookup(stat.pc, region, offset) & ~entry->footprint;
+    for (int i = 0; i < SMS_REGION_BLOCKS; i++)
+    {
+        if ((footprint >> i) & 1)
+        {
+            issue_candidate(((Addr) region * SMS_REGION_BLOCKS + i) * BLOCK_SIZE, 0, 2);
+        }
+    }
+}
+
+/*========*/
+/* Stream */
+/*========*/
+
+typedef int64_t Stream_Block;
+
+typedef struct {
+    int8_t valid;
+    int8_t direction;     /* +1, -1 or 0 while unknown */
+    int8_t confirmations; /* Steps taken in direction */
+    int8_t distance;      /* How far ahead to stay, ramps up */
+    Stream_Block last;    /* Last block accessed */
+    Stream_Block head;    /* Furthest block prefetched */
+    uint32_t used;
+} Stream_Entry;
+
+Stream_Entry streams[STREAM_COUNT];
+uint32_t stream_time;
+
+void stream_init()
+{
+    stream_time = 0;
+}
+
+/* Whether the blocks between two are all cached or on their way, as when their plain hits were filtered out */
+int stream_gap_present(Stream_Block from, Stream_Block to)
+{
+    int direction = to > from ? 1 : -1;
+    for (Stream_Block block = from + direction; block != to; block += direction)
+    {
+        Addr addr = (Addr) block * BLOCK_SIZE;
+        if (!in_cache(addr) && !in_mshr_queue(addr)) return 0;
+    }
+    return 1;
+}
+
+/* Find the stream a block continues: the nearest in its window, with nothing missing in between */
+Stream_Entry *stream_find(Stream_Block block)
+{
+    Stream_Entry *nearest = NULL;
+    Stream_Block nearest_distance = STREAM_WINDOW + 1;
+    for (int i = 0; i < STREAM_COUNT; i++)
+    {
+        Stream_Block distance = block > streams[i].last ? block - streams[i].last : streams[i].last - block;
+        if (streams[i].valid && distance < nearest_distance)
+        {
+            nearest = &streams[i];
+            nearest_distance = distance;
+        }
+    }
+    if (nearest == NULL || !stream_gap_present(nearest->last, block)) return NULL;
+    return nearest;
+}
+
+/* Start tracking in place of the least recently used stream */
+void stream_new(Stream_Block block)
+{
+    Stream_Entry *victim = &streams[0];
+    for (int i = 1; i < STREAM_COUNT && victim->valid; i++)
+    {
+        if (!streams[i].valid || streams[i].used < victim->used)
+        {
+            victim = &streams[i];
+        }
+    }
+    victim->valid = 1;
+    victim->direction = 0;
+    victim->confirmations = 0;
+    victim->distance = STREAM_DISTANCE_START;
+    victim->last = block;
+    victim->head = block;
+    victim->used = stream_time;
+}
+
+/* Returns 1 if the access belongs to a confirmed stream and was served */
+int stream_access(AccessStat stat)
+{
+    Stream_Block block = stat.mem_addr / BLOCK_SIZE;
+    stream_time++;
+    
+    Stream_Entry *entry = stream_find(block);
+    if (entry == NULL)
+    {
+        stream_new(block);
+        return 0;
+    }
+    entry->used = stream_time;
+    
+    Stream_Block step = block - entry->last;
+    if (step == 0) return entry->confirmations >= STREAM_CONFIRM;
+    
+    /* Confirm or restart direction, the steps must stay monotonic */
+    int direction = step > 0 ? 1 : -1;
+    if (direction == entry->direction)
+    {
+        if (entry->confirmations < STREAM_CONFIRM) entry->confirmations++;
+    }
+    else
+    {
+        entry->direction = direction;
+        entry->confirmations = 1;
+        entry->distance = STREAM_DISTANCE_START;
+        entry->head = block;
+    }
+    entry->last = block;
+    if (entry->confirmations < STREAM_CONFIRM) return 0;
+    
+    /* Ramp up and run ahead */
+    if (entry->distance < STREAM_DISTANCE_MAX) entry->distance++;
+    if ((entry->head - block) * direction < 0) entry->head = block;
+    for (int i = 0; i < STREAM_DEGREE && (entry->head - block) * direction < entry->distance; i++)
+    {
+        entry->head += direction;
+        if (entry->head < 0) break;
+        issue_candidate((Addr) entry->head * BLOCK_SIZE, i, PERCEPTRON_CONFIDENCE_MAX);
+    }
+    return 1;
+}
+
+/*=====*/
+/* RPT */
+/*=====*/
+
+#define RPT_INIT 0
+#define RPT_TRANSIENT 1
+#define RPT_STEADY 2
+#define RPT_NO_PRED 3
+
+typedef struct {
+    Addr pc;
+    Addr last_address;
+    int32_t stride;
+    int8_t state;
+} RPT_Entry;
+
+RPT_Entry rpt[RPT_SIZE];
+
+void rpt_init()
+{
+    for (int i = 0; i < RPT_SIZE; i++)
+    {
+        rpt[i].pc = 0;
+        rpt[i].state = RPT_INIT;
+    }
+}
+
+/* Returns 1 if the PC is in steady state and was served */
+int rpt_access(AccessStat stat)
+{
+    RPT_Entry *entry = &rpt[(stat.pc ^ (stat.pc >> 6)) % RPT_SIZE];
+    
+    /* Create if missing */
+    if (entry->pc != stat.pc)
+    {
+        entry->pc = stat.pc;
+        entry->last_address = stat.mem_addr;
+        entry->stride = 0;
+        entry->state = RPT_INIT;
+        return 0;
+    }
+    
+    /* Move through the state machine */
+    int32_t stride = stat.mem_addr - entry->last_address;
+    int correct = stride == entry->stride;
+    switch (entry->state)
+    {
+        case RPT_INIT:
+            entry->state = correct ? RPT_STEADY : RPT_TRANSIENT;
+            break;
+        case RPT_TRANSIENT:
+            entry->state = correct ? RPT_STEADY : RPT_NO_PRED;
+            break;
+        case RPT_STEADY:
+            entry->state = correct ? RPT_STEADY : RPT_INIT;
+            break;
+        case RPT_NO_PRED:
+            entry->state = correct ? RPT_TRANSIENT : RPT_NO_PRED;
+            break;
+    }
+    if (!correct && entry->state != RPT_INIT)
+    {
+        entry->stride = stride;
+    }
+    entry->last_address = stat.mem_addr;
+    
+    if (entry->state != RPT_STEADY || entry->stride == 0)
+    {
+        return 0;
+    }
+    
+    /* Prefetch along the stride */
+    Addr addr = stat.mem_addr;
+    for (int i = 0; i < RPT_DEGREE; i++)
+    {
+        addr += entry->stride;
+        issue_candidate(addr, i, PERCEPTRON_CONFIDENCE_MAX);
+    }
+    return 1;
+}
+
+/* Number of PCs currently in steady state */
+int rpt_steady_count()
+{
+    int count = 0;
+    for (int i = 0; i < RPT_SIZE; i++)
+    {
+        if (rpt[i].state == RPT_STEADY && rpt[i].stride != 0) count++;
+    }
+    return count;
+}
+
+/*==========*/
+/* Temporal */
+/*==========*/
+
+typedef uint32_t Temporal_Block;
+
+typedef struct {
+    Temporal_Block block;
+    Temporal_Block successor;
+    int8_t valid;
+    int8_t confidence;
+    uint32_t used;
+} Temporal_Entry;
+
+typedef struct {
+    Addr pc;
+    Temporal_Block block;
+} Temporal_Last;
+
+Temporal_Entry temporal[TEMPORAL_SETS][TEMPORAL_WAYS];
+Temporal_Last temporal_last[TEMPORAL_LAST_SIZE];
+uint32_t temporal_time;
+
+void temporal_init()
+{
+    temporal_time = 0;
+}
+
+/* Hash the set so that aligned nodes spread over all sets */
+Temporal_Entry *temporal_set(Temporal_Block block)
+{
+    return temporal[hash_slot(block, TEMPORAL_SETS)];
+}
+
+Temporal_Entry *temporal_find(Temporal_Block block)
+{
+    Temporal_Entry *set = temporal_set(block);
+    for (int i = 0; i < TEMPORAL_WAYS; i++)
+    {
+        if (set[i].valid && set[i].block == block)
+        {
+            return &set[i];
+        }
+    }
+    return NULL;
+}
+
+/* Record that successor missed right after block */
+void temporal_store(Temporal_Block block, Temporal_Block successor)
+{
+    Temporal_Entry *entry = temporal_find(block);
+    if (entry == NULL)
+    {
+        /* Replace least recently used way */
+        Temporal_Entry *set = temporal_set(block);
+        entry = &set[0];
+        for (int i = 1; i < TEMPORAL_WAYS && entry->valid; i++)
+        {
+            if (!set[i].valid || set[i].used < entry->used)
+            {
+                entry = &set[i];
+            }
+        }
+        entry->valid = 1;
+        entry->block = block;
+        entry->successor = successor;
+        entry->confidence = 0;
+    }
+    else if (entry->successor == successor)
+    {
+        if (entry->confidence < TEMPORAL_CONFIDENCE_MAX) entry->confidence++;
+    }
+    else if (entry->confidence > 0)
+    {
+        entry->confidence--;
+    }
+    else
+    {
+        entry->successor = successor;
+    }
+    entry->used = temporal_time;
+}
+
+void temporal_access(AccessStat stat)
+{
+    Temporal_Block block = stat.mem_addr / BLOCK_SIZE;
+    temporal_time++;
+    
+    /* Link to the previous miss of the same PC (or of anyone) */
+    Addr pc = TEMPORAL_PC_LOCALIZED ? stat.pc : 0;
+    Temporal_Last *last = &temporal_last[(pc ^ (pc >> 6)) % TEMPORAL_LAST_SIZE];
+    if (last->pc == pc && last->block != 0 && last->block != block)
+    {
+        temporal_store(last->block, block);
+    }
+    last->pc = pc;
+    last->block = block;
+    
+    /* Follow the successor chain */
+    stat_temporal_lookups++;
+    Temporal_Block current = block;
+    for (int i = 0; i < TEMPORAL_DEGREE; i++)
+    {
+        Temporal_Entry *entry = temporal_find(current);
+        if (entry == NULL) break;
+        if (i == 0) stat_temporal_found++;
+        entry->used = temporal_time;
+        current = entry->successor;
+        issue_candidate((Addr) current * BLOCK_SIZE, i, entry->confidence);
+    }
+}
+
+/*===========*/
+/* Pollution */
+/*===========*/
+
+typedef uint32_t Pollution_Block;
+
+/* A block of a shadow set, as far as we know it is in the cache */
+typedef struct {
+    Pollution_Block block;
+    int8_t valid;
+    int8_t prefetched; /* Filled by a prefetch and not demanded since */
+} Pollution_Entry;
+
+typedef struct {
+    Pollution_Entry way[POLLUTION_WAYS];
+    uint32_t fills; /* Kinds of fills not yet matched to a victim, oldest in bit 0, 1 for prefetch */
+    int8_t fill_count;
+} Pollution_Set;
+
+Pollution_Set pollution_shadow[POLLUTION_SAMPLED_SETS];
+uint8_t pollution_victims[POLLUTION_BLOOM_BITS / 8];
+int pollution_victim_count;
+int64_t pollution_fills, pollution_evicted_unused; /* Prefetch fills in shadow sets, and those never used */
+int64_t pollution_misses, pollution_polluted; /* Demand misses in shadow sets, and those caused by prefetches */
+int64_t pollution_untracked; /* Fills that found no free way or no room for their kind, the set had lost track */
+
+void pollution_bloom_clear()
+{
+    for (int i = 0; i < POLLUTION_BLOOM_BITS / 8; i++)
+    {
+        pollution_victims[i] = 0;
+    }
+    pollution_victim_count = 0;
+}
+
+void pollution_init()
+{
+    for (int s = 0; s < POLLUTION_SAMPLED_SETS; s++)
+    {
+        for (int w = 0; w < POLLUTION_WAYS; w++)
+        {
+            pollution_shadow[s].way[w].valid = 0;
+        }
+        pollution_shadow[s].fills = 0;
+        pollution_shadow[s].fill_count = 0;
+    }
+    pollution_bloom_clear();
+    pollution_fills = 0;
+    pollution_evicted_unused = 0;
+    pollution_misses = 0;
+    pollution_polluted = 0;
+    pollution_untracked = 0;
+}
+
+/* Shadow set of a block, or NULL if its set isn't sampled */
+Pollution_Set *pollution_set(Pollution_Block block)
+{
+    int set = block % POLLUTION_SETS;
+    int stride = POLLUTION_SETS / POLLUTION_SAMPLED_SETS;
+    if (set % stride != 0) return NULL;
+    return &pollution_shadow[set / stride];
+}
+
+/* The two Bloom filter bits of a block */
+int pollution_bloom_hash(Pollution_Block block, int k)
+{
+    uint32_t hash = block * (k ? 2246822519u : 2654435761u);
+    return (hash ^ (hash >> 15)) % POLLUTION_BLOOM_BITS;
+}
+
+/* Old victims are forgotten all at once when the filter fills up */
+void pollution_bloom_insert(Pollution_Block block)
+{
+    if (++pollution_victim_count > POLLUTION_BLOOM_INSERTS)
+    {
+        pollution_bloom_clear();
+        pollution_victim_count = 1;
+    }
+    for (int k = 0; k < 2; k++)
+    {
+        int bit = pollution_bloom_hash(block, k);
+        pollution_victims[bit / 8] |= 1 << (bit % 8);
+    }
+}
+
+int pollution_bloom_test(Pollution_Block block)
+{
+    for (int k = 0; k < 2; k++)
+    {
+        int bit = pollution_bloom_hash(block, k);
+        if (!((pollution_victims[bit / 8] >> (bit % 8)) & 1)) return 0;
+    }
+    return 1;
+}
+
+/*
+ * Drops a block that left a shadow set. We can't see victims, so it is
+ * charged to the oldest fill of the set not yet charged with one, and to
+ * a demand fill if there is none.
+ */
+void pollution_drop(Pollution_Set *set, Pollution_Entry *entry)
+{
+    if (entry->prefetched)
+    {
+        pollution_evicted_unused++;
+    }
+    if (set->fill_count > 0)
+    {
+        if (set->fills & 1) pollution_bloom_insert(entry->block);
+        set->fills >>= 1;
+        set->fill_count--;
+    }
+    entry->valid = 0;
+}
+
+/*
+ * Drops the blocks of a shadow set that left the cache. Demand misses are
+ * tracked before their fill, so blocks still in the MSHR queue have not
+ * arrived yet rather than left.
+ */
+void pollution_evict(Pollution_Set *set)
+{
+    for (int w = 0; w < POLLUTION_WAYS; w++)
+    {
+        Pollution_Entry *entry = &set->way[w];
+        Addr addr = (Addr) entry->block * BLOCK_SIZE;
+        if (!entry->valid || in_cache(addr) || in_mshr_queue(addr)) continue;
+        pollution_drop(set, entry);
+    }
+}
+
+/* Tracks a block filling a shadow set, reusing the way of a block already gone, returns 1 if it is new to the set */
+int pollution_fill(Pollution_Set *set, Pollution_Block block, int prefetched)
+{
+    Pollution_Entry *free = NULL;
+    for (int w = 0; w < POLLUTION_WAYS; w++)
+    {
+        if (set->way[w].valid && set->way[w].block == block)
+        {
+            /* Nothing new was filled, and a late prefetch doesn't undo the demand */
+            if (!prefetched) set->way[w].prefetched = 0;
+            return 0;
+        }
+        if (!set->way[w].valid && free == NULL) free = &set->way[w];
+    }
+    
+    /* No free way means a block left unseen, so one is dropped as if evicted now */
+    if (free == NULL)
+    {
+        pollution_untracked++;
+        free = &set->way[block % POLLUTION_WAYS];
+        pollution_drop(set, free);
+    }
+    
+    /* The oldest fill never met its victim, forget it */
+    if (set->fill_count == POLLUTION_FILLS)
+    {
+        pollution_untracked++;
+        set->fills >>= 1;
+        set->fill_count--;
+    }
+    set->fills |= (uint32_t) prefetched << set->fill_count;
+    set->fill_count++;
+    
+    free->block = block;
+    free->valid = 1;
+    free->prefetched = prefetched;
+    return 1;
+}
+
+void pollution_access(AccessStat stat)
+{
+    Pollution_Block block = stat.mem_addr / BLOCK_SIZE;
+    Pollution_Set *set = pollution_set(block);
+    if (set == NULL) return;
+    
+    pollution_evict(set);
+    if (stat.miss)
+    {
+        /* Missing a block a prefetch pushed out is pollution */
+        pollution_misses++;
+        if (pollution_bloom_test(block)) pollution_polluted++;
+        pollution_fill(set, block, 0);
+    }
+    else
+    {
+        /* Demanded, no longer an unused prefetch */
+        for (int w = 0; w < POLLUTION_WAYS; w++)
+        {
+            if (set->way[w].valid && set->way[w].block == block) set->way[w].prefetched = 0;
+        }
+    }
+}
+
+void pollution_complete(Addr addr)
+{
+    Pollution_Block block = addr / BLOCK_SIZE;
+    Pollution_Set *set = pollution_set(block);
+    if (set == NULL) return;
+    
+    pollution_evict(set);
+    if (pollution_fill(set, block, 1)) pollution_fills++;
+}
+
+/* Share of demand misses in shadow sets caused by prefetches */
+int64_t pollution_rate()
+{
+    return pollution_misses < POLLUTION_SAMPLES_MIN ? 0 : stats_rate(pollution_polluted, pollution_misses);
+}
+
+/* Share of prefetch fills in shadow sets evicted before they were demanded */
+int64_t pollution_evicted_unused_rate()
+{
+    return pollution_fills < POLLUTION_SAMPLES_MIN ? 0 : stats_rate(pollution_evicted_unused, pollution_fills);
+}
+
+void pollution_calibrate()
+{
+    pollution_fills /= 2;
+    pollution_evicted_unused /= 2;
+    pollution_misses /= 2;
+    pollution_polluted /= 2;
+}
+
+/*=====*/
+/* FDP */
+/*=====*/
+
+typedef struct {
+    int degree;
+    int partial_degree; /* 0 turns partial matching off */
+    int distance; /* Candidates skipped before the first one issued, out of those beyond the degree */
+} FDP_Level;
+
+FDP_Level fdp_levels[FDP_LEVELS] = {
+    {1, 0, 0},
+    {2, 1, 0},
+    {3, 2, 0},
+    {4, 2, 1},
+    {6, 3, 2},
+};
+
+int fdp_level = FDP_LEVEL_START;
+
+/* A miss on a block still in the MSHR queue was prefetched too late */
+void fdp_access(AccessStat stat)
+{
+    if (stat.miss && in_mshr_queue(stat.mem_addr))
+    {
+        stat_late++;
+    }
+}
+
+/*
+ * Level change for one interval, following the FDP decision table. We see
+ * few late prefetches from here, so accurate and harmless intervals also
+ * climb back to the start level after a bad phase. Without the pollution
+ * tracker the pollution column is never taken, which leaves a two input
+ * table of accuracy and lateness.
+ */
+int fdp_decide(int level, int64_t accuracy, int64_t lateness, int64_t pollution)
+{
+    int late = lateness > FDP_LATENESS_HIGH;
+    int polluting = POLLUTION_ENABLED && pollution > FDP_POLLUTION_HIGH;
+    if (accuracy >= FDP_ACCURACY_HIGH)
+    {
+        if (late) return 1;
+        if (polluting) return -1;
+        return level < FDP_LEVEL_START ? 1 : 0;
+    }
+    if (accuracy >= FDP_ACCURACY_LOW)
+    {
+        if (late && !polluting) return 1;
+        return polluting ? -1 : 0;
+    }
+    return late || polluting ? -1 : 0;
+}
+
+/*============*/
+/* Controller */
+/*============*/
+
+/* One calibration interval, rates in parts of RATE_FACTOR */
+typedef struct {
+    int measured; /* Enough prefetches completed for the rates to mean anything */
+    int64_t accuracy;
+    int64_t coverage;
+    int64_t lateness;
+    int64_t pollution;
+} Controller_Sample;
+
+typedef struct {
+    int level;
+    int partial;
+    int discard;
+    int trial; /* Knob being tried this interval */
+    int before; /* Its setting before the trial */
+    int cooldown;
+    int64_t score; /* Smoothed score of the settings in use */
+    int scored; /* Whether score holds a measured interval yet */
+    uint32_t seed;
+} Controller_State;
+
+Controller_State controller;
+
+void controller_init()
+{
+    controller.level = FDP_LEVEL_START;
+    controller.partial = 1;
+    controller.discard = DCPT_DISCARD_ENABLED;
+    controller.trial = CONTROLLER_KNOB_NONE;
+    controller.before = 0;
+    controller.cooldown = CONTROLLER_COOLDOWN;
+    controller.score = 0;
+    controller.scored = 0;
+    controller.seed = CONTROLLER_SEED;
+}
+
+Controller_Sample controller_sample(int64_t accuracy)
+{
+    Controller_Sample sample;
+    int64_t misses = stat_read - stat_read_hits;
+    int64_t useful = stat_issued_hits + stat_late;
+    sample.measured = stat_issued - 1 >= FDP_SAMPLES_MIN; /* stat_issued starts at 1 */
+    sample.accuracy = accuracy;
+    sample.coverage = stats_rate(stat_issued_hits, stat_issued_hits + misses);
+    sample.lateness = useful < FDP_SAMPLES_MIN ? 0 : stats_rate(stat_late, useful);
+    sample.pollution = POLLUTION_ENABLED ? pollution_rate() : 0;
+    return sample;
+}
+
+int controller_clamp_level(int level)
+{
+    if (level < 0) return 0;
+    if (level >= FDP_LEVELS) return FDP_LEVELS - 1;
+    return level;
+}
+
+/* Settings packed as traced: level, then partial, discard and the trial plus one */
+uint32_t controller_settings(Controller_State state)
+{
+    return state.level | state.partial << 8 | state.discard << 9 | (state.trial + 1) << 10;
+}
+
+/* The setting a knob turns */
+int *controller_setting(Controller_State *state, int knob)
+{
+    if (knob == CONTROLLER_KNOB_PARTIAL) return &state->partial;
+    if (knob == CONTROLLER_KNOB_DISCARD) return &state->discard;
+    return &state->level;
+}
+
+Controller_State controller_turn(Controller_State state, int knob)
+{
+    if (knob == CONTROLLER_KNOB_PARTIAL) state.partial = !state.partial;
+    if (knob == CONTROLLER_KNOB_DISCARD) state.discard = !state.discard;
+    if (knob == CONTROLLER_KNOB_UP) state.level = controller_clamp_level(state.level + 1);
+    if (knob == CONTROLLER_KNOB_DOWN) state.level = controller_clamp_level(state.level - 1);
+    return state;
+}
+
+/*
+ * Settings for the next interval.
+ *
+ * FDP moves the level between trials. After a cooldown a knob is picked
+ * at random now and then and turned for one interval, and the change is
+ * kept only if it beats the smoothed score by the hysteresis, otherwise
+ * the setting from before the trial comes back. This reads
+ * nothing but its arguments, so replaying logged samples from the same
+ * state repeats every decision, see tools/controller_replay.cc.
+ */
+Controller_State controller_decide(Controller_State state, Controller_Sample sample)
+{
+    int64_t score = sample.coverage - (RATE_FACTOR - sample.accuracy) / CONTROLLER_INACCURACY_COST;
+    
+    /* Judge the trial, one that leaves nothing to measure hasn't shown a gain */
+    if (state.trial != CONTROLLER_KNOB_NONE)
+    {
+        if (sample.measured && score >= state.score + CONTROLLER_HYSTERESIS)
+        {
+            state.score = score;
+        }
+        else
+        {
+            *controller_setting(&state, state.trial) = state.before;
+        }
+        state.trial = CONTROLLER_KNOB_NONE;
+        state.cooldown = CONTROLLER_COOLDOWN;
+        return state;
+    }
+    
+    /* An idle interval says nothing about the settings */
+    if (!sample.measured)
+    {
+        return state;
+    }
+    state.score = state.scored ? (state.score + score) / 2 : score;
+    state.scored = 1;
+    if (FDP_ENABLED)
+    {
+        state.level = controller_clamp_level(state.level + fdp_decide(state.level, sample.accuracy, sample.lateness, sample.pollution));
+    }
+    
+    /* Explore */
+    if (state.cooldown > 0)
+    {
+        state.cooldown--;
+        return state;
+    }
+    state.seed = state.seed * 1103515245 + 12345;
+    uint32_t draw = state.seed >> 16;
+    if (draw % CONTROLLER_EXPLORE_ODDS == 0)
+    {
+        int knob = (draw / CONTROLLER_EXPLORE_ODDS) % CONTROLLER_KNOBS;
+        int before = *controller_setting(&state, knob);
+        state = controller_turn(state, knob);
+        
+        /* A level already at its limit has nothing to try */
+        if (*controller_setting(&state, knob) != before)
+        {
+            state.trial = knob;
+            state.before = before;
+        }
+    }
+    return state;
+}
+
+/* Settings for the next interval, from the controller or from FDP alone */
+Controller_State controller_next(Controller_State state, Controller_Sample sample)
+{
+    if (CONTROLLER_ENABLED)
+    {
+        return controller_decide(state, sample);
+    }
+    if (sample.measured)
+    {
+        state.level = controller_clamp_level(state.level + fdp_decide(state.level, sample.accuracy, sample.lateness, sample.pollution));
+    }
+    return state;
+}
+
+/* Traces a sample and the settings it led to, rates fit in 32 bits */
+void controller_trace(Controller_Sample sample, Controller_State state)
+{
+    TRACE(TRACE_SAMPLE, (uint64_t) sample.accuracy << 32 | (uint32_t) sample.coverage, sample.measured);
+    TRACE(TRACE_FEEDBACK, (uint64_t) sample.lateness << 32 | (uint32_t) sample.pollution, 0);
+    TRACE(TRACE_DECISION, state.score, controller_settings(state));
+}
+
+/*============*/
+/* Prefetcher */
+/*============*/
+
+void prefetcher_init()
+{
+    dcpt_init(DCPT_SIZE);
+    if (GHB_ENABLED || TOURNAMENT_ENABLED) ghb_init();
+    if (BO_ENABLED) bo_init();
+    if (SPP_ENABLED) spp_init();
+    if (VLDP_ENABLED) vldp_init();
+    if (AMPM_ENABLED) ampm_init();
+    if (SMS_ENABLED) sms_init();
+    if (STREAM_ENABLED) stream_init();
+    if (RPT_ENABLED) rpt_init();
+    if (TOURNAMENT_ENABLED) tournament_init();
+    if (TEMPORAL_ENABLED) temporal_init();
+    if (POLLUTION_ENABLED) pollution_init();
+    if (PENDING_ENABLED) pending_init();
+    if (TIMELY_ENABLED) timely_init();
+    controller_init();
+    if (ADAPTIVE_ENABLED) adaptive_init();
+    if (PERCEPTRON_ENABLED) perceptron_init();
+}
+
+void dcpt_access(AccessStat stat)
+{
+    /* Get data */
+    DCPT_Addr pc = stat.pc;
     DCPT_Addr addr = stat.mem_addr;
     
     /* Find entry */
@@ -295,8 +2874,19 @@ void prefetcher_access(AccessStat stat)
     if (entry == NULL)
     {
         entry = dcpt_new(pc, addr);
+        stat_new_dcpt++;
+    }
+    
+    /* Time between this PC's accesses */
+    if (TIMELY_ENABLED)
+    {
+        if (entry->last_time != 0) entry->interval = timely_average(entry->interval, stat.time - entry->last_time);
+        entry->last_time = stat.time;
     }
     
+    /* Learn whether crossing pages pays off for this PC */
+    if (DCPT_CROSS_PAGE_ENABLED) dcpt_cross_train(entry, addr);
+    
     /* Store new delta */
     DCPT_Addr delta = (addr - entry->last_address) >> DCPT_DELTA_DISCARD_BITS;
     if (delta < DCPT_DELTA_MIN || delta > DCPT_DELTA_MAX)
@@ -315,37 +2905,159 @@ void prefetcher_access(AccessStat stat)
         
         /* Find and prefetch candidates */
         int c = dcpt_candidates_find(entry);
-        int max = PREFETCH_DEGREE_MAX;
-        if (c == 0)
+        FDP_Level *level = &fdp_levels[fdp_level];
+        int max = adaptive_degree(entry->confidence, level->degree);
+        int confidence = PERCEPTRON_CONFIDENCE_MAX;
+        if (c == 0 && level->partial_degree > 0 && dcpt_partial)
         {
             /* Fallback to partial matching */
             c = dcpt_candidates_find_partial(entry);
-            max = PREFETCH_DEGREE_PARTIAL_MAX;
+            max = adaptive_degree(entry->confidence, level->partial_degree);
+            confidence = 1;
+        }
+        TRACE(TRACE_MATCH, stat.mem_addr, c);
+        /* A short match has no candidates to spare, so higher levels never issue fewer */
+        int distance = level->distance;
+        if (distance > c - max) distance = c > max ? c - max : 0;
+        if (TIMELY_ENABLED && timely_distance(entry->interval) > distance)
+        {
+            distance = timely_distance(entry->interval);
         }
-        for (int i = 0; i < c && i < max; i++)
+        adaptive_owner = &entry->confidence;
+        for (int i = distance; i < c && i < distance + max; i++)
         {
             DCPT_Addr addr = dcpt_candidates[i];
-            issue_if_needed(addr);
+            issue_candidate(addr, i, confidence);
             entry->last_prefetch = addr;
         }
+        adaptive_owner = NULL;
     }
 }
 
-void prefetcher_calibrate()
+void prefetcher_access(AccessStat stat, int prefetch_hit)
 {
-    /* TODO */
+    /* The filter learns from every access, plain hits included */
+    if (PERCEPTRON_ENABLED) perceptron_access(stat, prefetch_hit);
+    if (FDP_ENABLED) fdp_access(stat);
+    if (TIMELY_ENABLED) timely_access(stat);
+    if (ADAPTIVE_ENABLED) adaptive_access(stat, prefetch_hit);
+    if (PENDING_ENABLED) pending_drain();
+    if (POLLUTION_ENABLED) pollution_access(stat);
+    if (TOURNAMENT_ENABLED) tournament_access(stat);
+    
+    /* Skip plain hits, but keep training on prefetched streams */
+    if (!stat.miss && !prefetch_hit && DCPT_TRAIN_FILTER_ENABLED)
+    {
+        return;
+    }
+    
+    /* Run engines */
+    if (GHB_ENABLED && !TOURNAMENT_ENABLED) ghb_access(stat);
+    if (BO_ENABLED) bo_access(stat);
+    if (SPP_ENABLED) spp_access(stat);
+    if (VLDP_ENABLED) vldp_access(stat);
+    if (AMPM_ENABLED) ampm_access(stat);
+    if (SMS_ENABLED) sms_access(stat);
+    if (TEMPORAL_ENABLED) temporal_access(stat);
+    
+    /* The duelling engines all see every access, the tournament decides who may issue where */
+    if (TOURNAMENT_ENABLED)
+    {
+        tournament_engine = TOURNAMENT_GHB;
+        ghb_access(stat);
+        tournament_engine = TOURNAMENT_STRIDE;
+        if (RPT_ENABLED && rpt_access(stat)) stats_served(STAGE_RPT, stat.pc);
+        else if (STREAM_ENABLED && stream_access(stat)) stats_served(STAGE_STREAM, stat.pc);
+        tournament_engine = TOURNAMENT_DCPT;
+        dcpt_access(stat);
+        stats_served(STAGE_DCPT, stat.pc);
+        tournament_engine = TOURNAMENT_ANY;
+        return;
+    }
     
+    /* Steady strides and sequential streams are served here and never reach DCPT */
+    if (RPT_ENABLED && rpt_access(stat))
+    {
+        stats_served(STAGE_RPT, stat.pc);
+        return;
+    }
+    if (STREAM_ENABLED && stream_access(stat))
+    {
+        stats_served(STAGE_STREAM, stat.pc);
+        return;
+    }
+    stats_served(STAGE_DCPT, stat.pc);
+    dcpt_access(stat);
+}
+
+void prefetcher_complete(Addr addr)
+{
+    if (BO_ENABLED) bo_complete(addr);
+    if (POLLUTION_ENABLED) pollution_complete(addr);
+    if (TIMELY_ENABLED) timely_complete(addr);
+}
+
+void prefetcher_calibrate()
+{
     /* Get statistics */
     int hit_rate = stats_hit_rate();
     int issued_hit_rate = stats_issued_hit_rate();
     
     /* Dump some info */
-    if (VERBOSE >= 1)
+    if (LOG_ENABLED(1))
     {
-        printf("[] Calibrating...\n");
-        printf(" - Hit rate: %d\n", hit_rate);
-        printf(" - Issued hit rate: %d\n", issued_hit_rate);
+        LOG_INFO("[] Calibrating...\n");
+        LOG_INFO(" - Hit rate: %d\n", hit_rate);
+        LOG_INFO(" - Issued hit rate: %d\n", issued_hit_rate);
+        if (GHB_ENABLED)
+        {
+            LOG_INFO(" - GHB PC chain accuracy: %d\n", (int) ghb_accuracy(GHB_CHAIN_PC));
+            LOG_INFO(" - GHB CZone chain accuracy: %d\n", (int) ghb_accuracy(GHB_CHAIN_CZONE));
+        }
+        LOG_INFO(" - Served by RPT: %d accesses from %d PCs, %d steady PCs\n", (int) stat_served[STAGE_RPT], stats_served_pcs(STAGE_RPT), RPT_ENABLED ? rpt_steady_count() : 0);
+        LOG_INFO(" - Served by stream: %d accesses from %d PCs\n", (int) stat_served[STAGE_STREAM], stats_served_pcs(STAGE_STREAM));
+        LOG_INFO(" - Served by DCPT: %d accesses from %d PCs, %d new PCs\n", (int) stat_served[STAGE_DCPT], stats_served_pcs(STAGE_DCPT), (int) stat_new_dcpt);
+        if (TEMPORAL_ENABLED)
+        {
+            LOG_INFO(" - Temporal successors found: %d\n", (int) stats_rate(stat_temporal_found, stat_temporal_lookups));
+        }
+        if (TIMELY_ENABLED)
+        {
+            LOG_INFO(" - Prefetch latency: %d\n", (int) timely_latency);
+        }
+        if (POLLUTION_ENABLED)
+        {
+            LOG_INFO(" - Pollution: %d of misses, %d of prefetches evicted unused, %d untracked fills\n", (int) pollution_rate(), (int) pollution_evicted_unused_rate(), (int) pollution_untracked);
+        }
+        if (TOURNAMENT_ENABLED)
+        {
+            LOG_INFO(" - Tournament winner: %d (misses DCPT %d, GHB %d, stride %d)\n", tournament_winner,
+                (int) tournament_misses[TOURNAMENT_DCPT], (int) tournament_misses[TOURNAMENT_GHB], (int) tournament_misses[TOURNAMENT_STRIDE]);
+        }
+        if (BO_ENABLED)
+        {
+            LOG_INFO(" - BO offset: %d (score %d)\n", bo_offset, bo_best_score);
+        }
     }
+    
+    /* Decide how hard DCPT pushes from this interval's feedback */
+    if (CONTROLLER_ENABLED || FDP_ENABLED)
+    {
+        Controller_Sample sample = controller_sample(issued_hit_rate);
+        controller = controller_next(controller, sample);
+        controller_trace(sample, controller);
+        fdp_level = controller.level;
+        dcpt_partial = controller.partial;
+        dcpt_discard = controller.discard;
+        LOG_INFO(" - Controller: accuracy %d, coverage %d, lateness %d, pollution %d -> score %d, level %d, partial %d, discard %d, trial %d\n",
+            (int) sample.accuracy, (int) sample.coverage, (int) sample.lateness, (int) sample.pollution,
+            (int) controller.score, controller.level, controller.partial, controller.discard, controller.trial);
+    }
+    if (POLLUTION_ENABLED) pollution_calibrate();
+    
+    if (GHB_ENABLED || TOURNAMENT_ENABLED) ghb_calibrate();
+    if (TOURNAMENT_ENABLED) tournament_calibrate();
+    TRACE_FLUSH();
 
     // Reset stats
     stats_reset();
@@ -0,0 +1,5 @@
+/* Stand-in for the m5 trace header, so the tools build without the simulator. */
+
+#include <stdio.h>
+
+#define DPRINTF(flag, ...) printf(__VA_ARGS__)
@@ -0,0 +1,190 @@
+/* Offline replay of the prefetcher controller. */
+
+/*
+ * Builds the controller from the same prefetcher.cc, so the magic numbers
+ * must match those of the traced run.
+ *
+ *  controller_replay FILE     - feeds the samples traced in FILE to
+ *                               controller_next from the initial state and
+ *                               reports every interval whose score or
+ *                               settings differ from the traced ones
+ *  controller_replay --check N - drives controller_decide with random
+ *                               samples for seeds 1 to N, from both ends of
+ *                               the level range, and checks that no trial is
+ *                               a no-op and that a lost trial brings back
+ *                               every setting
+ *
+ * Both exit with 1 on a mismatch or a failed check.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../prefetcher.cc"
+
+#define CHECK_INTERVALS 400 /* Intervals per seed, enough for dozens of trials */
+
+/* The simulator isn't linked, the controller never calls into it */
+void issue_prefetch(Addr addr) {}
+int get_prefetch_bit(Addr addr) { return 0; }
+void set_prefetch_bit(Addr addr) {}
+void clear_prefetch_bit(Addr addr) {}
+int in_cache(Addr addr) { return 0; }
+int in_mshr_queue(Addr addr) { return 0; }
+int current_queue_size(void) { return 0; }
+
+/*========*/
+/* Replay */
+/*========*/
+
+int replay(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Can't open %s\n", path);
+        return 1;
+    }
+    
+    controller_init();
+    Controller_State state = controller;
+    Controller_Sample sample;
+    memset(&sample, 0, sizeof(sample));
+    int intervals = 0;
+    int mismatches = 0;
+    TraceEvent event;
+    while (fread(&event, sizeof(TraceEvent), 1, file) == 1)
+    {
+        if (event.type == TRACE_SAMPLE)
+        {
+            sample.accuracy = event.a >> 32;
+            sample.coverage = (uint32_t) event.a;
+            sample.measured = event.b;
+        }
+        if (event.type == TRACE_FEEDBACK)
+        {
+            sample.lateness = event.a >> 32;
+            sample.pollution = (uint32_t) event.a;
+        }
+        if (event.type != TRACE_DECISION) continue;
+        
+        state = controller_next(state, sample);
+        intervals++;
+        if ((int64_t) event.a != state.score || event.b != controller_settings(state))
+        {
+            printf("Interval %d: traced score %d, settings %#x, replayed score %d, settings %#x\n", intervals,
+                (int) (int64_t) event.a, event.b, (int) state.score, controller_settings(state));
+            mismatches++;
+        }
+    }
+    fclose(file);
+    
+    printf("%d intervals replayed, %d mismatches\n", intervals, mismatches);
+    return mismatches > 0;
+}
+
+/*=======*/
+/* Check */
+/*=======*/
+
+uint32_t check_random; /* Draws the samples, apart from the controller's own seed */
+
+int64_t check_draw(int64_t range)
+{
+    check_random = check_random * 1103515245 + 12345;
+    return (check_random >> 8) % range;
+}
+
+Controller_Sample check_sample()
+{
+    Controller_Sample sample;
+    sample.measured = check_draw(8) != 0;
+    sample.accuracy = check_draw(RATE_FACTOR + 1);
+    sample.coverage = check_draw(RATE_FACTOR + 1);
+    sample.lateness = check_draw(RATE_FACTOR + 1);
+    sample.pollution = check_draw(RATE_FACTOR + 1);
+    return sample;
+}
+
+int check_same_settings(Controller_State a, Controller_State b)
+{
+    return a.level == b.level && a.partial == b.partial && a.discard == b.discard;
+}
+
+/* Runs one seed from a starting level, returns the number of failures */
+int check_seed(uint32_t seed, int level, int *trials)
+{
+    controller_init();
+    Controller_State state = controller;
+    state.seed = seed;
+    state.level = level;
+    check_random = seed;
+    
+    int failures = 0;
+    Controller_State tried = state; /* State the current trial started from */
+    for (int i = 0; i < CHECK_INTERVALS; i++)
+    {
+        Controller_Sample sample = check_sample();
+        Controller_State next = controller_decide(state, sample);
+        if (next.level < 0 || next.level >= FDP_LEVELS)
+        {
+            printf("Seed %u, level %d, interval %d: level %d out of range\n", seed, level, i, next.level);
+            failures++;
+        }
+        
+        /* A trial starts */
+        if (state.trial == CONTROLLER_KNOB_NONE && next.trial != CONTROLLER_KNOB_NONE)
+        {
+            (*trials)++;
+            tried = next;
+            if (*controller_setting(&next, next.trial) == next.before)
+            {
+                printf("Seed %u, level %d, interval %d: trial of knob %d changes nothing\n", seed, level, i, next.trial);
+                failures++;
+            }
+        }
+        
+        /* A trial is judged, kept as tried or undone */
+        if (state.trial != CONTROLLER_KNOB_NONE)
+        {
+            Controller_State undone = tried;
+            *controller_setting(&undone, tried.trial) = tried.before;
+            int kept = sample.measured && check_same_settings(next, tried);
+            if (!kept && !check_same_settings(next, undone))
+            {
+                printf("Seed %u, level %d, interval %d: lost trial of knob %d left level %d, partial %d, discard %d\n",
+                    seed, level, i, tried.trial, next.level, next.partial, next.discard);
+                failures++;
+            }
+        }
+        state = next;
+    }
+    return failures;
+}
+
+int check(int seeds)
+{
+    int failures = 0;
+    int trials = 0;
+    for (int seed = 1; seed <= seeds; seed++)
+    {
+        failures += check_seed(seed, 0, &trials);
+        failures += check_seed(seed, FDP_LEVELS - 1, &trials);
+    }
+    printf("%d seeds, %d trials, %d failures\n", seeds, trials, failures);
+    return failures > 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 3 && strcmp(argv[1], "--check") == 0)
+    {
+        return check(atoi(argv[2]));
+    }
+    if (argc == 2)
+    {
+        return replay(argv[1]);
+    }
+    fprintf(stderr, "Usage: %s TRACE_FILE | --check SEEDS\n", argv[0]);
+    return 1;
+}